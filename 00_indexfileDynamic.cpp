@@ -1,6 +1,50 @@
 #include <iostream>
 #include <vector>
+#include <string>
 #include <algorithm>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <thread>
+#include <functional>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <future>
+#include <optional>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <climits>
+#include <charconv>
+#include <queue>
+#include <random>
+#include <cmath>
+#include <map>
+#include <unordered_map>
+
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#endif
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/io_uring.h>
 
 
 #define BLOCKS 3 // Number of blocks
@@ -9,8 +53,14 @@
 #define PMAX N*BLOCKS // Maximum number of records per Data Area on the index file
 
 #define OVER (PMAX+1) // Index where the overflow block starts
+#define BUFFERED -3 // Lookup (where) of a record found in the write buffer
 #define OMAX 3 // Limit of the overflow block
 
+#define BLOCK_PAGE 4096 // Size of the page of a block on the file
+#define OVERFLOW_PAGE -2 // Block number of the page of the overflow area
+#define CHECKPOINT_RUN 256 // Pages written (or read) by each request of a checkpoint (1 MiB)
+#define CHECKPOINT_RUNS 4 // Requests of a checkpoint in flight
+
 // -------------------------------------------------------------
 // ----------------- Record Class ----------------------------
 // -------------------------------------------------------------
@@ -22,38 +72,402 @@ private:
     int key;
     T value;
 	int direction; // direction to the record that has moved to the overflow area, or a new block
+
+    // Build the value with the block allocator when T can use it (e.g. std::pmr::string),
+    // so the value lives on the same arena as the record
+    template <typename... Args>
+    static T MakeValue(const std::pmr::polymorphic_allocator<std::byte>& alloc, Args&&... args)
+    {
+        if constexpr (std::uses_allocator_v<T, std::pmr::polymorphic_allocator<std::byte>>)
+        {
+            return T(std::forward<Args>(args)..., alloc);
+        }
+        else
+        {
+            return T(std::forward<Args>(args)...);
+        }
+    }
 public:
-	Record(int key_, T value_) : key(key_), value(value_), direction(-1) {}
+    using allocator_type = std::pmr::polymorphic_allocator<std::byte>;
+
+	Record(int key_, T value_) : key(key_), value(std::move(value_)), direction(-1) {}
 
     Record() : key(0), value(), direction(-1) {}
 
+    // Allocator-extended constructors, used by the pmr containers of the blocks
+    template <typename... Args>
+    Record(std::allocator_arg_t, const allocator_type& alloc, int key_, Args&&... args)
+        : key(key_), value(MakeValue(alloc, std::forward<Args>(args)...)), direction(-1) {}
+
+    Record(std::allocator_arg_t, const allocator_type& alloc, const Record& other)
+        : key(other.key), value(MakeValue(alloc, other.value)), direction(other.direction) {}
+
+    Record(std::allocator_arg_t, const allocator_type& alloc, Record&& other)
+        : key(other.key), value(MakeValue(alloc, std::move(other.value))), direction(other.direction) {}
+
+    Record(const Record&) = default;
+    Record(Record&&) = default;
+    Record& operator=(const Record&) = default;
+    Record& operator=(Record&&) = default;
+
     int getKey() const { return key; }
-    T getValue() const { return value; }
+    const T& getValue() const { return value; } // Return a reference, no copy of the value
     int getDirection() const { return direction; }
     void setDirection(int dir) { direction = dir; }
 
     bool operator<(const Record<T>& other) const { return key < other.key; }
 };
 
+// Read-only view of a record (no copy of the value)
+template <typename T>
+class RecordView
+{
+private:
+    const Record<T>* m_Rec;
+public:
+    RecordView(const Record<T>& rec) : m_Rec(&rec) {}
+
+    int getKey() const { return m_Rec->getKey(); }
+    const T& getValue() const { return m_Rec->getValue(); }
+    int getDirection() const { return m_Rec->getDirection(); }
+};
+
+// -------------------------------------------------------------
+// ----------------- Search Functions --------------------------
+// -------------------------------------------------------------
+
+#define SEARCH_LINEAR 8 // Ranges up to this size are scanned, not searched
+
+// Position of the first key greater than (key) on the sorted range [low, high).
+// (keyOf) returns the key of a position, (probes) the number of keys compared
+template <typename KeyOf>
+int BinaryUpperBound(int key, int low, int high, KeyOf keyOf, int* probes)
+{
+    while (low < high)
+    {
+        int mid = low + (high - low) / 2;
+
+        if (probes != nullptr)
+            (*probes)++;
+
+        if (keyOf(mid) <= key)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low;
+}
+
+// Same as BinaryUpperBound, but the next position is predicted from the keys at the ends of
+// the range. After two predictions in a row that don't halve the range the next step is a
+// binary one, so skewed keys cost at most about three times the probes of a binary search
+template <typename KeyOf>
+int InterpolationUpperBound(int key, int low, int high, KeyOf keyOf, int* probes)
+{
+    if (low >= high)
+        return low;
+
+    if (probes != nullptr)
+        (*probes) += 2;
+
+    int lowKey = keyOf(low);
+
+    if (key < lowKey)
+        return low;
+
+    int highKey = keyOf(high - 1);
+
+    if (key >= highKey)
+        return high;
+
+    // keyOf(lo) <= key < keyOf(hi), the position is on (lo, hi]
+    int lo = low;
+    int hi = high - 1;
+    bool interpolate = true;
+    int slow = 0; // Steps in a row that didn't halve the range
+
+    while (hi - lo > 1)
+    {
+        int size = hi - lo;
+        int pos;
+
+        if (interpolate)
+        {
+            pos = lo + (int)(((double)key - lowKey) / ((double)highKey - lowKey) * size);
+            pos = std::clamp(pos, lo + 1, hi - 1);
+        }
+        else
+        {
+            pos = lo + size / 2;
+        }
+
+        int k = keyOf(pos);
+
+        if (probes != nullptr)
+            (*probes)++;
+
+        if (k <= key)
+        {
+            lo = pos;
+            lowKey = k;
+        }
+        else
+        {
+            hi = pos;
+            highKey = k;
+        }
+
+        slow = ((hi - lo) * 2 <= size) ? 0 : slow + 1;
+        interpolate = slow < 2;
+    }
+
+    return hi;
+}
+
+// Check if the keys of the sorted range [low, high) grow evenly: the keys at 1/4, 1/2 and 3/4
+// of the range must be near the line that joins the first and the last key
+template <typename KeyOf>
+bool KeysUniform(int low, int high, KeyOf keyOf)
+{
+    if (high - low <= SEARCH_LINEAR)
+        return false;
+
+    double first = keyOf(low);
+    double span = (double)keyOf(high - 1) - first;
+
+    if (span <= 0)
+        return false;
+
+    for (int q = 1; q <= 3; q++)
+    {
+        int pos = low + (high - 1 - low) * q / 4;
+        double expected = first + span * (pos - low) / (high - 1 - low);
+
+        if (std::abs(keyOf(pos) - expected) > span / 8)
+            return false;
+    }
+
+    return true;
+}
+
+// -------------------------------------------------------------
+// ----------------- Zone Map Struct ---------------------------
+// -------------------------------------------------------------
+
+// Summary of a group of records: key range and count, and for numeric values their sum,
+// minimum and maximum (always empty for other values)
+struct ZoneMap
+{
+    int count = 0;
+    int minKey = INT_MAX;
+    int maxKey = INT_MIN;
+
+    double sum = 0;
+    double minValue = HUGE_VAL;
+    double maxValue = -HUGE_VAL;
+
+    template <typename T>
+    void Add(const Record<T>& rec)
+    {
+        count++;
+        minKey = std::min(minKey, rec.getKey());
+        maxKey = std::max(maxKey, rec.getKey());
+
+        if constexpr (std::is_arithmetic_v<T>)
+        {
+            double value = rec.getValue();
+
+            sum += value;
+            minValue = std::min(minValue, value);
+            maxValue = std::max(maxValue, value);
+        }
+    }
+
+    void Merge(const ZoneMap& other)
+    {
+        count += other.count;
+        minKey = std::min(minKey, other.minKey);
+        maxKey = std::max(maxKey, other.maxKey);
+        sum += other.sum;
+        minValue = std::min(minValue, other.minValue);
+        maxValue = std::max(maxValue, other.maxValue);
+    }
+
+    bool Overlaps(int from, int to) const { return count > 0 && minKey <= to && maxKey >= from; } // Some record may be on [from, to]
+
+    bool Within(int from, int to) const { return from <= minKey && maxKey <= to; } // All the records are on [from, to]
+
+    double Average() const { return count ? sum / count : 0.0; }
+};
+
 // -------------------------------------------------------------
 // ----------------- Block Class ---------------------------
 // -------------------------------------------------------------
 
+#define PAGE_ALIGN_MIN 1024 // Arrays of records from this size start on a page
+#define LINE_ALIGN_MIN 128 // Arrays of records from this size start on a cache line
+
+// Alignment asked for an array of records of (bytes): a lookup on a block touches the fewest pages and lines
+inline size_t RecordsAlignment(size_t bytes)
+{
+    return (bytes >= PAGE_ALIGN_MIN) ? BLOCK_PAGE : (bytes >= LINE_ALIGN_MIN) ? 64 : alignof(std::max_align_t);
+}
+
+// Allocator of the records of a block: the array of the records asks its resource for its own
+// alignment. The values of the records are built with the plain polymorphic allocator of the same
+// resource, so they keep their natural alignment
+template <typename U>
+class RecordsAllocator : public std::pmr::polymorphic_allocator<U>
+{
+private:
+    size_t m_Alignment;
+public:
+    RecordsAllocator(std::pmr::memory_resource* resource, size_t alignment)
+        : std::pmr::polymorphic_allocator<U>(resource), m_Alignment(std::max(alignment, alignof(U))) {}
+
+    template <typename V>
+    RecordsAllocator(const RecordsAllocator<V>& other)
+        : std::pmr::polymorphic_allocator<U>(other.resource()), m_Alignment(std::max(other.getAlignment(), alignof(U))) {}
+
+    size_t getAlignment() const { return m_Alignment; }
+
+    U* allocate(size_t n) { return (U*)this->resource()->allocate(n * sizeof(U), m_Alignment); }
+
+    void deallocate(U* p, size_t n) { this->resource()->deallocate(p, n * sizeof(U), m_Alignment); }
+
+    // A copied container goes to the default heap with the natural alignment
+    RecordsAllocator select_on_container_copy_construction() const { return RecordsAllocator(std::pmr::get_default_resource(), alignof(U)); }
+};
+
 template <typename T>
 class Block
 {
 private:
-    std::vector<Record<T>> records;
+    std::vector<Record<T>, RecordsAllocator<Record<T>>> records; // Records allocated on the arena of the Data Area
 
     int capacity; // Maximum number of records per block
+
+    uint64_t version; // Incremented on each change of the records (used by the snapshots)
+
+    bool uniform; // The keys grow evenly, Find uses interpolation search (updated on each change)
+
+    ZoneMap zone; // Summary of the records (updated on each change)
+
+    void Classify() { uniform = KeysUniform(0, records.size(), [this](int i) { return records[i].getKey(); }); }
+
+    void Summarize()
+    {
+        zone = ZoneMap();
+
+        for (auto& rec : records)
+            zone.Add(rec);
+    }
 public:
-    Block(int cap) : capacity(cap) { records.reserve(capacity); } // Reserve space for N records
+    Block(int cap, std::pmr::memory_resource* arena = std::pmr::get_default_resource())
+        : records(RecordsAllocator<Record<T>>(arena, RecordsAlignment(cap * sizeof(Record<T>)))), capacity(cap), version(0), uniform(false)
+    {
+        records.reserve(capacity); // Reserve space for N records
+    }
+
+    // Copy of a block on the default heap (a version of the block for the snapshots)
+    Block(const Block& other) : records(other.records, RecordsAllocator<Record<T>>(std::pmr::get_default_resource(), alignof(Record<T>))), capacity(other.capacity), version(other.version), uniform(other.uniform), zone(other.zone) {}
+
+    Block(Block&&) = default;
+
+    uint64_t getVersion() const { return version; }
+
+    void Touch() { version++; Classify(); Summarize(); } // Mark the block as changed (call it after changing a record through getRecords)
+
+    const ZoneMap& getZone() const { return zone; }
+
+    bool IsUniform() const { return uniform; }
+
+    // Position of the first record with the key, or -1. (probes) returns the number of keys compared
+    int Find(int key, int* probes = nullptr) const
+    {
+        int n = records.size();
+
+        if (n <= SEARCH_LINEAR)
+        {
+            for (int i = 0; i < n; i++)
+            {
+                if (probes != nullptr)
+                    (*probes)++;
+
+                if (records[i].getKey() == key)
+                    return i;
+            }
+
+            return -1;
+        }
+
+        if (key == INT_MIN)
+            return (records[0].getKey() == key) ? 0 : -1;
+
+        auto keyOf = [this](int i) { return records[i].getKey(); };
+
+        // First record with a key not lower than (key)
+        int pos = uniform ? InterpolationUpperBound(key - 1, 0, n, keyOf, probes) : BinaryUpperBound(key - 1, 0, n, keyOf, probes);
+
+        if (pos < n && probes != nullptr)
+            (*probes)++;
+
+        return (pos < n && records[pos].getKey() == key) ? pos : -1;
+    }
 
     bool IsFull() { return (records.size() >= capacity); } // Check if the block is full
 
-    std::vector<Record<T>>& getRecords() { return records; } // Get all the records in the block
+    int getCapacity() const { return capacity; } // Get the maximum number of records of the block
+
+    std::vector<Record<T>, RecordsAllocator<Record<T>>>& getRecords() { return records; } // Get all the records in the block
+
+    const std::vector<Record<T>, RecordsAllocator<Record<T>>>& getRecords() const { return records; }
+
+    // Build the record in place at its sorted position (no temporary copies of the value)
+    template <typename... Args>
+    int EmplaceRecord(int key, Args&&... args)
+    {
+        if (!IsFull())
+        {
+            // Find the position to insert the record
+            auto it = std::upper_bound(records.begin(), records.end(), key, [](int k, const auto& rec) { return k < rec.getKey(); });
+
+            int pos = it - records.begin(); // Get the position of the iterator
+
+            records.emplace(it, key, std::forward<Args>(args)...); // The records stay sorted, no need to sort again
+            version++;
+            Classify();
+            zone.Add(records[pos]); // Only the new record is added to the summary
 
-    int AddRecord(const Record<T>& rec)
+            return pos; // Return the position of the new record
+        }
+
+        return -1; // Return -1 if the block is full
+    }
+
+    // Merge records sorted by key in one pass, after the records of the block with the same key.
+    // Only the first ones that fit are taken, returns how many
+    template <typename It>
+    int MergeRecords(It first, It last)
+    {
+        int count = std::min<int>(last - first, capacity - (int)records.size());
+
+        if (count <= 0)
+            return 0;
+
+        int size = records.size();
+
+        for (It it = first; it != first + count; ++it)
+            records.push_back(std::move(*it));
+
+        std::inplace_merge(records.begin(), records.begin() + size, records.end(), [](const auto& a, const auto& b) { return a.getKey() < b.getKey(); });
+        Touch();
+
+        return count;
+    }
+
+    int AddRecord(Record<T> rec)
     {
         if (!IsFull())
         {
@@ -61,10 +475,10 @@ public:
             
             int pos = it - records.begin(); // Get the position of the iterator
 
-            records.insert(it, rec); // Insert the new record (rec) in position (it) 
-
-            // Sort the records
-            std::sort(records.begin(), records.end(), [](auto& a, auto& b) { return a.getKey() < b.getKey(); });
+            records.insert(it, std::move(rec)); // Insert the new record (rec) in position (it) 
+            version++;
+            Classify();
+            zone.Add(records[pos]);
 
             return pos; // Return the position of the new record
         }
@@ -74,405 +488,6521 @@ public:
 };
 
 // -------------------------------------------------------------
-// ----------------- DataArea Class ---------------------------
+// ----------------- Block File Classes ------------------------
 // -------------------------------------------------------------
 
-template <typename T>
-class DataArea
+// Minimal io_uring ring (raw system calls, no liburing)
+class IoUring
 {
 private:
-    std::vector<Block<T>> m_Blocks;
-    Block<T> OverflowArea;
-    
-    int capacity; // Registers per block
-    int maxBlocks; // Maximum number of blocks -> defined by the user
-    int usedBlocks; // Number of blocks used
+    int m_Fd;
+
+    void* m_SqRing;
+    void* m_CqRing;
+    size_t m_SqRingSize;
+    size_t m_CqRingSize;
+
+    io_uring_sqe* m_Sqes;
+    size_t m_SqesSize;
+
+    unsigned* m_SqHead;
+    unsigned* m_SqTail;
+    unsigned* m_SqMask;
+    unsigned* m_SqArray;
+
+    unsigned* m_CqHead;
+    unsigned* m_CqTail;
+    unsigned* m_CqMask;
+    io_uring_cqe* m_Cqes;
+
+    unsigned m_Entries;
+    unsigned m_Queued; // SQEs written but not submitted yet
 public:
-    DataArea(int cap, int nBlocks_, int capOverflow) : OverflowArea(capOverflow), capacity(cap), maxBlocks(nBlocks_), usedBlocks(0)
+    IoUring() : m_Fd(-1), m_SqRing(MAP_FAILED), m_CqRing(MAP_FAILED), m_SqRingSize(0), m_CqRingSize(0),
+                m_Sqes((io_uring_sqe*)MAP_FAILED), m_SqesSize(0), m_Entries(0), m_Queued(0) {}
+
+    ~IoUring() { Close(); }
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    bool IsOpen() const { return m_Fd >= 0; }
+
+    unsigned getEntries() const { return m_Entries; }
+
+    // Create the ring, returns false if the kernel doesn't support (or allow) io_uring
+    bool Init(unsigned entries)
     {
-        m_Blocks.reserve(maxBlocks); // Reserve space for the maximum number of blocks
-        AddBlock(); // Add the first block
-    }
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
 
-    int getUsedBlocks() { return usedBlocks; } // Get the number of blocks used
+        int fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+
+        if (fd < 0)
+        {
+            return false;
+        }
 
-    std::vector<Block<T>>& getBlocks() { return m_Blocks; } // Get all the blocks in the Data Area
+        m_Fd = fd;
+        m_Entries = params.sq_entries;
 
-    Block<T>& getOverflow() { return OverflowArea; } // Get the overflow block
+        m_SqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        m_CqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
 
-	// Add a new record to the Data Area
-	int AddBlock()
-	{
-        if (usedBlocks < maxBlocks)
+        bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+
+        if (singleMap)
         {
-            m_Blocks.emplace_back(capacity);
-            return usedBlocks++;
+            m_SqRingSize = m_CqRingSize = std::max(m_SqRingSize, m_CqRingSize);
         }
 
-        return -1; // This means that the Data Area is full (no more blocks can be added)
-	}
+        m_SqRing = mmap(nullptr, m_SqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_Fd, IORING_OFF_SQ_RING);
 
-    std::string AddRecordToData(int index, const Record<T>& rec)
-    {
-        if (index < 0 || index >= usedBlocks) 
+        if (m_SqRing == MAP_FAILED)
         {
-            return "Error: Invalid block\n";
+            Close();
+            return false;
         }
 
-        Block<T>& actualBlock = m_Blocks[index]; // Get the actual block
+        if (singleMap)
+        {
+            m_CqRing = m_SqRing;
+        }
+        else
+        {
+            m_CqRing = mmap(nullptr, m_CqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_Fd, IORING_OFF_CQ_RING);
 
-        // Check if the record is trying to be added at the end of the block
+            if (m_CqRing == MAP_FAILED)
+            {
+                Close();
+                return false;
+            }
+        }
 
-        // Get the actual size of the block
-        int actualSize = actualBlock.getRecords().size();
+        m_SqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        m_Sqes = (io_uring_sqe*)mmap(nullptr, m_SqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_Fd, IORING_OFF_SQES);
 
-        // Get the records to compare with the new one
-        auto& records = actualBlock.getRecords();
+        if (m_Sqes == MAP_FAILED)
+        {
+            Close();
+            return false;
+        }
 
-        auto it = std::upper_bound(records.begin(), records.end(), rec, [](const auto& a, const auto& b){
-            return a.getKey() < b.getKey();
-        }); // Find the position to insert the record
+        char* sq = (char*)m_SqRing;
+        char* cq = (char*)m_CqRing;
 
-        int pos = it - records.begin(); // Get the position of the iterator (it)
+        m_SqHead = (unsigned*)(sq + params.sq_off.head);
+        m_SqTail = (unsigned*)(sq + params.sq_off.tail);
+        m_SqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+        m_SqArray = (unsigned*)(sq + params.sq_off.array);
 
-        if (pos == actualSize && actualSize >= (capacity + 1)/2) // If the block is full 
+        m_CqHead = (unsigned*)(cq + params.cq_off.head);
+        m_CqTail = (unsigned*)(cq + params.cq_off.tail);
+        m_CqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+        m_Cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+        return true;
+    }
+
+    void Close()
+    {
+        if (m_Sqes != MAP_FAILED)
+            munmap(m_Sqes, m_SqesSize);
+
+        if (m_CqRing != MAP_FAILED && m_CqRing != m_SqRing)
+            munmap(m_CqRing, m_CqRingSize);
+
+        if (m_SqRing != MAP_FAILED)
+            munmap(m_SqRing, m_SqRingSize);
+
+        if (m_Fd >= 0)
+            close(m_Fd);
+
+        m_Sqes = (io_uring_sqe*)MAP_FAILED;
+        m_SqRing = m_CqRing = MAP_FAILED;
+        m_Fd = -1;
+        m_Queued = 0;
+    }
+
+    // Get a free SQE to fill (nullptr if the submission queue is full)
+    io_uring_sqe* GetSqe()
+    {
+        unsigned head = __atomic_load_n(m_SqHead, __ATOMIC_ACQUIRE);
+        unsigned tail = *m_SqTail + m_Queued;
+
+        if (tail - head >= m_Entries)
         {
-            // Try to add a new block
-            int index2 = AddBlock();
+            return nullptr;
+        }
 
-            if (index2 != -1)
+        unsigned index = tail & *m_SqMask;
+        io_uring_sqe* sqe = &m_Sqes[index];
+
+        std::memset(sqe, 0, sizeof(*sqe));
+        m_SqArray[index] = index;
+        m_Queued++;
+
+        return sqe;
+    }
+
+    // Submit the queued SQEs, and the ones that a previous call couldn't submit, and wait for (waitFor)
+    // completions. A short submit is retried. Returns the number of SQEs submitted, or -errno if none
+    // was: with -EAGAIN or -EBUSY (the kernel is short of memory, or the completions must be reaped
+    // first) the SQEs stay on the ring for the next call, with any other error see DropUnsubmitted
+    int Submit(unsigned waitFor)
+    {
+        __atomic_store_n(m_SqTail, *m_SqTail + m_Queued, __ATOMIC_RELEASE);
+        m_Queued = 0;
+
+        int submitted = 0;
+
+        while (true)
+        {
+            unsigned pending = *m_SqTail - __atomic_load_n(m_SqHead, __ATOMIC_ACQUIRE);
+
+            if (pending == 0 && waitFor == 0)
             {
-                Block<T>& newBlock = m_Blocks[index2];
-                
-                int pos2 = newBlock.AddRecord(rec);
-                
-                if (pos2 < 0)
-                {
-                    return "Error: New block is full";
-                }
+                return submitted;
+            }
 
-                std::string result = "Block " + std::to_string(index2);
-                return result;
+            int result = (int)syscall(__NR_io_uring_enter, m_Fd, pending, waitFor, waitFor > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+
+            if (result < 0 && errno == EINTR)
+            {
+                continue;
             }
-            else // No more blocks can be added, so the record will be added to the overflow area
+
+            if (result < 0)
             {
-                return AddOverflow(rec);
+                return (submitted > 0) ? submitted : -errno;
             }
-        }
-        else // If the block is not full
+
+            submitted += result;
+
+            // All submitted (the kernel has waited too), or no progress: the rest stays for the next call
+            if ((unsigned)result >= pending || result == 0)
+            {
+                return submitted;
+            }
+        }
+    }
+
+    // Take back the SQEs that the kernel didn't submit (after an error of Submit that isn't a
+    // shortage), (drop)(user_data) is called for each of them
+    template <typename Drop>
+    void DropUnsubmitted(Drop&& drop)
+    {
+        unsigned head = __atomic_load_n(m_SqHead, __ATOMIC_ACQUIRE);
+
+        for (unsigned i = head; i != *m_SqTail; i++)
+        {
+            drop(m_Sqes[m_SqArray[i & *m_SqMask]].user_data);
+        }
+
+        __atomic_store_n(m_SqTail, head, __ATOMIC_RELEASE);
+    }
+
+    // Pop a completion if there is one
+    bool PopCompletion(io_uring_cqe& out)
+    {
+        unsigned head = *m_CqHead;
+
+        if (head == __atomic_load_n(m_CqTail, __ATOMIC_ACQUIRE))
+        {
+            return false;
+        }
+
+        out = m_Cqes[head & *m_CqMask];
+        __atomic_store_n(m_CqHead, head + 1, __ATOMIC_RELEASE);
+
+        return true;
+    }
+};
+
+// File of fixed size pages (BLOCK_PAGE bytes), read and written asynchronously.
+// The requests are queued and submitted in batches through io_uring, and the
+// callbacks run on Poll(); if io_uring is not available it falls back to pread/pwrite.
+// Opened as direct, the pages bypass the page cache (O_DIRECT): the buffers must be
+// aligned to BLOCK_PAGE (PageBuffer), as the offsets and lengths of the requests already are
+class BlockFile
+{
+public:
+    using Callback = std::function<void(int)>; // Receives the number of bytes transferred, or -errno
+private:
+    struct Request
+    {
+        bool write;
+        int page;
+        int pages; // Consecutive pages of the request
+        char* buffer;
+        Callback done;
+    };
+
+    int m_Fd;
+
+    bool m_Direct; // Opened with O_DIRECT
+
+    IoUring m_Ring;
+
+    std::vector<Request> m_Slots; // Requests in flight, the slot is the user_data of the SQE
+    std::vector<int> m_FreeSlots;
+    std::deque<Request> m_Waiting; // Requests waiting for a free SQE
+    std::deque<std::pair<Callback, int>> m_Done; // Completed requests (fallback path)
+
+    int m_InFlight;
+
+    bool Queue(Request& req)
+    {
+        if (m_FreeSlots.empty())
+        {
+            return false;
+        }
+
+        io_uring_sqe* sqe = m_Ring.GetSqe();
+
+        if (sqe == nullptr)
+        {
+            return false;
+        }
+
+        int slot = m_FreeSlots.back();
+        m_FreeSlots.pop_back();
+
+        sqe->opcode = req.write ? IORING_OP_WRITE : IORING_OP_READ;
+        sqe->fd = m_Fd;
+        sqe->addr = (uint64_t)(uintptr_t)req.buffer;
+        sqe->len = req.pages * BLOCK_PAGE;
+        sqe->off = (uint64_t)req.page * BLOCK_PAGE;
+        sqe->user_data = (uint64_t)slot;
+
+        m_Slots[slot] = std::move(req);
+        m_InFlight++;
+
+        return true;
+    }
+
+    void Fallback(Request& req)
+    {
+        off_t offset = (off_t)req.page * BLOCK_PAGE;
+        size_t length = (size_t)req.pages * BLOCK_PAGE;
+        ssize_t result = req.write ? pwrite(m_Fd, req.buffer, length, offset) : pread(m_Fd, req.buffer, length, offset);
+
+        m_Done.emplace_back(std::move(req.done), result < 0 ? -errno : (int)result);
+    }
+
+    void Enqueue(Request req)
+    {
+        if (!m_Ring.IsOpen())
+        {
+            Fallback(req);
+        }
+        else if (!m_Waiting.empty() || !Queue(req))
+        {
+            m_Waiting.push_back(std::move(req));
+        }
+    }
+public:
+    BlockFile() : m_Fd(-1), m_Direct(false), m_InFlight(0) {}
+
+    ~BlockFile() { Close(); }
+
+    BlockFile(const BlockFile&) = delete;
+    BlockFile& operator=(const BlockFile&) = delete;
+
+    // Open (or create) the file, (depth) is the number of requests that can be in flight.
+    // If (direct) but the file system doesn't support O_DIRECT, the file is opened buffered (see IsDirect)
+    bool Open(const std::string& path, bool create, unsigned depth = 64, bool direct = false)
+    {
+        Close();
+
+        int flags = O_RDWR | (create ? O_CREAT | O_TRUNC : 0);
+
+        m_Fd = direct ? open(path.c_str(), flags | O_DIRECT, 0644) : -1;
+        m_Direct = (m_Fd >= 0);
+
+        if (m_Fd < 0)
+        {
+            m_Fd = open(path.c_str(), flags, 0644);
+        }
+
+        if (m_Fd < 0)
+        {
+            return false;
+        }
+
+        if (m_Ring.Init(depth))
+        {
+            m_Slots.resize(m_Ring.getEntries());
+
+            for (int i = (int)m_Slots.size() - 1; i >= 0; i--)
+            {
+                m_FreeSlots.push_back(i);
+            }
+        }
+
+        return true;
+    }
+
+    void Close()
+    {
+        if (m_Fd >= 0)
+        {
+            Drain();
+            close(m_Fd);
+        }
+
+        m_Ring.Close();
+        m_Slots.clear();
+        m_FreeSlots.clear();
+        m_Fd = -1;
+        m_Direct = false;
+    }
+
+    bool IsOpen() const { return m_Fd >= 0; }
+
+    bool IsDirect() const { return m_Direct; } // Check if the pages bypass the page cache
+
+    bool UsesRing() const { return m_Ring.IsOpen(); } // Check if the requests go through io_uring
+
+    int getInFlight() const { return m_InFlight + (int)m_Waiting.size() + (int)m_Done.size(); }
+
+    void ReadAsync(int page, char* buffer, Callback done) { Enqueue({ false, page, 1, buffer, std::move(done) }); }
+
+    void WriteAsync(int page, const char* buffer, Callback done) { Enqueue({ true, page, 1, const_cast<char*>(buffer), std::move(done) }); }
+
+    // Read or write (pages) consecutive pages from (page) with one request
+    void ReadRunAsync(int page, int pages, char* buffer, Callback done) { Enqueue({ false, page, pages, buffer, std::move(done) }); }
+
+    void WriteRunAsync(int page, int pages, const char* buffer, Callback done) { Enqueue({ true, page, pages, const_cast<char*>(buffer), std::move(done) }); }
+
+    // Submit the queued requests and run the callbacks of the completed ones.
+    // If (wait) it blocks until at least one request is completed. Returns the number of completions
+    int Poll(bool wait)
+    {
+        int completed = 0;
+
+        while (!m_Waiting.empty() && Queue(m_Waiting.front()))
+        {
+            m_Waiting.pop_front();
+        }
+
+        // Fallback path: the requests were already done synchronously
+        while (!m_Done.empty())
+        {
+            auto done = std::move(m_Done.front());
+            m_Done.pop_front();
+
+            if (done.first)
+                done.first(done.second);
+
+            completed++;
+        }
+
+        if (!m_Ring.IsOpen())
+        {
+            return completed;
+        }
+
+        int submitted = m_Ring.Submit((wait && completed == 0 && m_InFlight > 0) ? 1 : 0);
+
+        if (submitted == -EAGAIN || submitted == -EBUSY)
+        {
+            std::this_thread::yield(); // The SQEs stay queued, the completions below make room for them
+        }
+        else if (submitted < 0)
+        {
+            // The ring refused the requests: they fail with the error (their callbacks run on the next Poll)
+            m_Ring.DropUnsubmitted([this, submitted](uint64_t slot)
+            {
+                m_Done.emplace_back(std::move(m_Slots[slot].done), submitted);
+                m_FreeSlots.push_back((int)slot);
+                m_InFlight--;
+            });
+        }
+
+        io_uring_cqe cqe;
+
+        while (m_Ring.PopCompletion(cqe))
+        {
+            int slot = (int)cqe.user_data;
+
+            Callback done = std::move(m_Slots[slot].done);
+            m_FreeSlots.push_back(slot);
+            m_InFlight--;
+
+            // Refill the ring with the requests that were waiting
+            while (!m_Waiting.empty() && Queue(m_Waiting.front()))
+            {
+                m_Waiting.pop_front();
+            }
+
+            if (done)
+                done(cqe.res); // The callback can enqueue new requests
+
+            completed++;
+        }
+
+        return completed;
+    }
+
+    // Wait until all the requests are completed
+    void Drain()
+    {
+        while (getInFlight() > 0)
+        {
+            Poll(true);
+        }
+    }
+
+    bool Sync() { return fsync(m_Fd) == 0; }
+};
+
+// Page aligned buffer for the block pages
+class PageBuffer
+{
+private:
+    char* m_Data;
+    size_t m_Pages;
+public:
+    PageBuffer(size_t pages = 1) : m_Data((char*)std::aligned_alloc(BLOCK_PAGE, pages * BLOCK_PAGE)), m_Pages(pages)
+    {
+        if (m_Data == nullptr && pages > 0)
+            throw std::bad_alloc(); // As the arenas: the callers have no page to use without it
+
+        if (m_Data != nullptr)
+            std::memset(m_Data, 0, pages * BLOCK_PAGE);
+    }
+
+    ~PageBuffer() { std::free(m_Data); }
+
+    PageBuffer(const PageBuffer&) = delete;
+    PageBuffer& operator=(const PageBuffer&) = delete;
+
+    PageBuffer(PageBuffer&& other) noexcept : m_Data(other.m_Data), m_Pages(other.m_Pages) { other.m_Data = nullptr; other.m_Pages = 0; }
+
+    char* getPage(size_t i = 0) { return m_Data + i * BLOCK_PAGE; }
+
+    size_t getPages() const { return m_Pages; }
+};
+
+// -------------------------------------------------------------
+// ----------------- Checksum Functions ------------------------
+// -------------------------------------------------------------
+
+// CRC32C (Castagnoli) of the pages of the file. It is computed with the crc32 instruction of
+// SSE4.2 when the CPU has it (checked once at run time), else with slicing-by-8 tables.
+// (crc) chains the calls: Crc32c(b, n2, Crc32c(a, n1)) is the CRC of a followed by b
+
+#define CRC32C_POLY 0x82F63B78 // Reversed polynomial of CRC32C
+
+struct Crc32cTables
+{
+    uint32_t table[8][256];
+
+    Crc32cTables()
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t crc = i;
+
+            for (int bit = 0; bit < 8; bit++)
+                crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLY : 0);
+
+            table[0][i] = crc;
+        }
+
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            for (int t = 1; t < 8; t++)
+                table[t][i] = (table[t - 1][i] >> 8) ^ table[0][table[t - 1][i] & 0xFF];
+        }
+    }
+};
+
+inline uint32_t Crc32cSoftware(const void* data, size_t length, uint32_t crc = 0)
+{
+    static const Crc32cTables tables;
+
+    const auto& t = tables.table;
+    const unsigned char* bytes = (const unsigned char*)data;
+    crc = ~crc;
+
+    while (length >= 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, bytes, 8);
+        word ^= crc; // Little endian: the CRC is applied to the first 4 bytes
+
+        crc = t[7][word & 0xFF] ^ t[6][(word >> 8) & 0xFF] ^ t[5][(word >> 16) & 0xFF] ^ t[4][(word >> 24) & 0xFF]
+            ^ t[3][(word >> 32) & 0xFF] ^ t[2][(word >> 40) & 0xFF] ^ t[1][(word >> 48) & 0xFF] ^ t[0][word >> 56];
+
+        bytes += 8;
+        length -= 8;
+    }
+
+    while (length-- > 0)
+        crc = (crc >> 8) ^ t[0][(crc ^ *bytes++) & 0xFF];
+
+    return ~crc;
+}
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+__attribute__((target("sse4.2")))
+inline uint32_t Crc32cHardware(const void* data, size_t length, uint32_t crc = 0)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    uint64_t crc64 = (uint32_t)~crc;
+
+    while (length >= 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, bytes, 8);
+        crc64 = __builtin_ia32_crc32di(crc64, word);
+
+        bytes += 8;
+        length -= 8;
+    }
+
+    uint32_t crc32 = (uint32_t)crc64;
+
+    while (length-- > 0)
+        crc32 = __builtin_ia32_crc32qi(crc32, *bytes++);
+
+    return ~crc32;
+}
+
+inline bool Crc32cHasHardware()
+{
+    static const bool sse42 = __builtin_cpu_supports("sse4.2");
+    return sse42;
+}
+#else
+inline uint32_t Crc32cHardware(const void* data, size_t length, uint32_t crc = 0) { return Crc32cSoftware(data, length, crc); }
+
+inline bool Crc32cHasHardware() { return false; }
+#endif
+
+inline uint32_t Crc32c(const void* data, size_t length, uint32_t crc = 0)
+{
+    return Crc32cHasHardware() ? Crc32cHardware(data, length, crc) : Crc32cSoftware(data, length, crc);
+}
+
+// -------------------------------------------------------------
+// ----------------- Page Functions ----------------------------
+// -------------------------------------------------------------
+
+// Layout of a page: [PageHeader][key, direction, length, value bytes]...
+
+struct PageHeader
+{
+    uint32_t magic;
+    int32_t block; // Number of the block (OVERFLOW_PAGE for the overflow area)
+    int32_t count; // Number of records
+    uint32_t used; // Bytes used by the records
+    uint32_t checksum; // CRC32C of the used bytes of the page (with this field at 0)
+};
+
+#define PAGE_MAGIC 0x49445853 // "IDXS"
+
+// First page of the file
+struct FileHeader
+{
+    uint32_t magic;
+    int32_t capacity;
+    int32_t maxBlocks;
+    int32_t usedBlocks;
+    int32_t overflowCapacity;
+    uint32_t checksum; // CRC32C of the header (with this field at 0), 0 on older files
+    uint64_t sequence; // Records added to the file when it was written (0 on older files)
+};
+
+// Values are stored as raw bytes: trivially copyable types as they are, strings as their characters
+template <typename T>
+const char* ValueBytes(const T& value, size_t& length)
+{
+    if constexpr (std::is_trivially_copyable_v<T>)
+    {
+        length = sizeof(T);
+        return (const char*)&value;
+    }
+    else
+    {
+        length = value.size() * sizeof(value[0]);
+        return (const char*)value.data();
+    }
+}
+
+// Write the records of a block on a page, returns false if they don't fit
+template <typename T>
+bool EncodePage(Block<T>& block, int blockNo, char* page)
+{
+    PageHeader header = { PAGE_MAGIC, blockNo, 0, 0, 0 };
+    size_t offset = sizeof(PageHeader);
+
+    for (auto& rec : block.getRecords())
+    {
+        size_t length;
+        const char* bytes = ValueBytes(rec.getValue(), length);
+
+        int32_t fields[3] = { rec.getKey(), rec.getDirection(), (int32_t)length };
+
+        if (offset + sizeof(fields) + length > BLOCK_PAGE)
+        {
+            return false;
+        }
+
+        std::memcpy(page + offset, fields, sizeof(fields));
+        std::memcpy(page + offset + sizeof(fields), bytes, length);
+
+        offset += sizeof(fields) + length;
+        header.count++;
+    }
+
+    header.used = (uint32_t)offset;
+
+    std::memset(page + offset, 0, BLOCK_PAGE - offset);
+    std::memcpy(page, &header, sizeof(header));
+
+    header.checksum = Crc32c(page, offset);
+    std::memcpy(page, &header, sizeof(header));
+
+    return true;
+}
+
+// Check the header and the checksum of a page written by EncodePage (a page never written, all
+// zeros, is not valid: the callers that can read one tell it apart by its block number)
+inline bool CheckPage(const char* page)
+{
+    PageHeader header;
+    std::memcpy(&header, page, sizeof(header));
+
+    if (header.magic != PAGE_MAGIC)
+        return false;
+
+    if (header.used < sizeof(header) || header.used > BLOCK_PAGE)
+        return false;
+
+    uint32_t checksum = header.checksum;
+    header.checksum = 0;
+
+    return Crc32c(page + sizeof(header), header.used - sizeof(header), Crc32c(&header, sizeof(header))) == checksum;
+}
+
+// Set the checksum of the file header at the start of (page)
+inline void SealFileHeader(char* page)
+{
+    uint32_t checksum = 0;
+    std::memcpy(page + offsetof(FileHeader, checksum), &checksum, sizeof(checksum));
+
+    checksum = Crc32c(page, sizeof(FileHeader));
+    std::memcpy(page + offsetof(FileHeader, checksum), &checksum, sizeof(checksum));
+}
+
+inline bool CheckFileHeader(const char* page)
+{
+    char bytes[sizeof(FileHeader)];
+    std::memcpy(bytes, page, sizeof(bytes));
+
+    uint32_t checksum;
+    std::memcpy(&checksum, bytes + offsetof(FileHeader, checksum), sizeof(checksum));
+
+    SealFileHeader(bytes);
+
+    return std::memcmp(bytes + offsetof(FileHeader, checksum), &checksum, sizeof(checksum)) == 0;
+}
+
+// Walk the records of a page: (visit)(key, direction, bytes, length), stops if it returns false
+template <typename Visitor>
+bool VisitPage(const char* page, Visitor&& visit)
+{
+    PageHeader header;
+    std::memcpy(&header, page, sizeof(header));
+
+    if (header.magic != PAGE_MAGIC || header.used > BLOCK_PAGE)
+    {
+        return false;
+    }
+
+    size_t offset = sizeof(PageHeader);
+
+    for (int i = 0; i < header.count; i++)
+    {
+        int32_t fields[3];
+
+        if (offset + sizeof(fields) > header.used)
+        {
+            return false;
+        }
+
+        std::memcpy(fields, page + offset, sizeof(fields));
+        offset += sizeof(fields);
+
+        if (fields[2] < 0 || offset + fields[2] > header.used)
+        {
+            return false;
+        }
+
+        if (!visit(fields[0], fields[1], page + offset, (size_t)fields[2]))
+        {
+            break;
+        }
+
+        offset += fields[2];
+    }
+
+    return true;
+}
+
+// Build a value from its bytes
+template <typename T, typename Alloc>
+T DecodeValue(const char* bytes, size_t length, const Alloc& alloc)
+{
+    if constexpr (std::is_trivially_copyable_v<T>)
+    {
+        T value;
+        std::memcpy(&value, bytes, std::min(length, sizeof(T)));
+        return value;
+    }
+    else if constexpr (std::uses_allocator_v<T, Alloc>)
+    {
+        return T((const typename T::value_type*)bytes, length / sizeof(typename T::value_type), alloc);
+    }
+    else
+    {
+        return T((const typename T::value_type*)bytes, length / sizeof(typename T::value_type));
+    }
+}
+
+// Read the records of the page of (blockNo) (OVERFLOW_PAGE for the overflow area) into an (empty)
+// block, returns false if the page is damaged or was written for another block
+template <typename T>
+bool DecodePage(const char* page, int blockNo, Block<T>& block)
+{
+    PageHeader header;
+    std::memcpy(&header, page, sizeof(header));
+
+    if (header.block != blockNo || !CheckPage(page))
+        return false;
+
+    return VisitPage(page, [&block](int key, int direction, const char* bytes, size_t length)
+    {
+        auto alloc = block.getRecords().get_allocator();
+        int pos = block.EmplaceRecord(key, DecodeValue<T>(bytes, length, alloc));
+
+        if (pos >= 0)
+        {
+            block.getRecords()[pos].setDirection(direction);
+        }
+
+        return pos >= 0;
+    });
+}
+
+// -------------------------------------------------------------
+// ----------------- PageArena Class ---------------------------
+// -------------------------------------------------------------
+
+#define HUGE_PAGE (2 << 20) // Size of a huge page
+#define SMALL_REGION (64 << 10) // Regions of the arenas smaller than half a huge page are rounded to this
+#define MAX_REGION (64 << 20) // Largest region mapped after the first one
+
+// Where a PageArena gets its memory from
+enum class HugePages
+{
+    NONE, // Normal pages
+    TRANSPARENT, // Regions aligned to huge pages and advised for transparent huge pages (MADV_HUGEPAGE)
+    EXPLICIT // Reserved huge pages (MAP_HUGETLB), transparent ones if there are none free
+};
+
+// Arena of a Data Area: bump allocation on regions mapped with mmap, all of them unmapped when
+// the arena is destroyed (the memory of a single allocation is never given back, as with a
+// monotonic buffer). Each allocation gets the alignment it asks for (the records of a big block ask
+// for a page of their own), the regions double up to MAX_REGION, and big arenas are backed by huge
+// pages to cut the TLB misses
+class PageArena : public std::pmr::memory_resource
+{
+private:
+    struct Region
+    {
+        char* base;
+        size_t size;
+    };
+
+    std::vector<Region> m_Regions;
+    char* m_Next; // Next free byte of the last region
+    char* m_End;
+
+    HugePages m_Mode;
+    size_t m_RegionSize; // Size of the next region
+
+    size_t m_Mapped; // Bytes of all the regions
+    size_t m_HugeMapped; // Bytes of the regions on huge pages (reserved, or advised with success)
+
+    static size_t RoundUp(size_t value, size_t to) { return (value + to - 1) / to * to; }
+
+    // Map a new region for at least (bytes)
+    void Map(size_t bytes)
+    {
+        size_t size = std::max(m_RegionSize, RoundUp(bytes, (bytes >= HUGE_PAGE / 2) ? HUGE_PAGE : BLOCK_PAGE));
+        bool hugeSize = (size % HUGE_PAGE == 0);
+        char* base = nullptr;
+        bool huge = false;
+
+        if (m_Mode == HugePages::EXPLICIT && hugeSize)
+        {
+            void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+            if (p != MAP_FAILED)
+            {
+                base = (char*)p;
+                huge = true;
+            }
+        }
+
+        if (base == nullptr && m_Mode != HugePages::NONE && hugeSize)
+        {
+            // One huge page more, to start the region on a huge page and unmap the rest
+            size_t extra = size + HUGE_PAGE;
+            void* p = mmap(nullptr, extra, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+            if (p != MAP_FAILED)
+            {
+                char* start = (char*)p;
+                char* aligned = (char*)RoundUp((uintptr_t)start, HUGE_PAGE);
+
+                if (aligned > start)
+                    munmap(start, aligned - start);
+
+                if (start + extra > aligned + size)
+                    munmap(aligned + size, (start + extra) - (aligned + size));
+
+                base = aligned;
+                huge = (madvise(base, size, MADV_HUGEPAGE) == 0);
+            }
+        }
+
+        if (base == nullptr)
+        {
+            void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+            if (p == MAP_FAILED)
+                throw std::bad_alloc(); // A memory_resource can't return nullptr
+
+            base = (char*)p;
+        }
+
+        m_Regions.push_back({ base, size });
+        m_Next = base;
+        m_End = base + size;
+
+        m_Mapped += size;
+        m_HugeMapped += huge ? size : 0;
+
+        // Each region is twice as big as the last one (few regions for a big arena), on whole huge pages once it is big
+        size_t grown = std::min<size_t>(m_RegionSize * 2, MAX_REGION);
+        m_RegionSize = (grown >= HUGE_PAGE / 2) ? RoundUp(grown, HUGE_PAGE) : grown;
+    }
+protected:
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        char* p = (char*)RoundUp((uintptr_t)m_Next, alignment);
+
+        if (m_Next == nullptr || p + bytes > m_End)
+        {
+            Map(bytes + alignment);
+            p = (char*)RoundUp((uintptr_t)m_Next, alignment);
+        }
+
+        m_Next = p + bytes;
+
+        return p;
+    }
+
+    void do_deallocate(void*, size_t, size_t) override {} // Released with the arena
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+public:
+    // (expected) is the size of the first region: the blocks of the Data Area
+    PageArena(size_t expected, HugePages mode = HugePages::TRANSPARENT)
+        : m_Next(nullptr), m_End(nullptr), m_Mode(mode), m_Mapped(0), m_HugeMapped(0)
+    {
+        m_RegionSize = (expected >= HUGE_PAGE / 2) ? RoundUp(expected, HUGE_PAGE) : RoundUp(std::max<size_t>(expected, 1), SMALL_REGION);
+    }
+
+    // Bytes taken on the arena by an array of records of (bytes), counting the padding of its alignment
+    static size_t Footprint(size_t bytes) { return RoundUp(bytes, RecordsAlignment(bytes)); }
+
+    PageArena(const PageArena&) = delete;
+    PageArena& operator=(const PageArena&) = delete;
+
+    ~PageArena()
+    {
+        for (auto& region : m_Regions)
+            munmap(region.base, region.size);
+    }
+
+    size_t getMapped() const { return m_Mapped; } // Get the bytes mapped by the arena
+
+    size_t getHugeMapped() const { return m_HugeMapped; } // Get the bytes mapped on huge pages
+};
+
+// -------------------------------------------------------------
+// ----------------- DataArea Class ---------------------------
+// -------------------------------------------------------------
+
+template <typename T>
+class DataArea
+{
+private:
+    // Arena for the blocks, records and values of this Data Area
+    // (it must be declared first, so it is destroyed after the blocks and released at once)
+    PageArena m_Arena;
+
+    std::pmr::vector<Block<T>> m_Blocks;
+    Block<T> OverflowArea;
+    
+    int capacity; // Registers per block
+    int maxBlocks; // Maximum number of blocks -> defined by the user
+    int usedBlocks; // Number of blocks used
+
+    // Last versions given to the snapshots
+    std::vector<std::shared_ptr<const Block<T>>> m_Published;
+    std::shared_ptr<const Block<T>> m_PublishedOverflow;
+public:
+    DataArea(int cap, int nBlocks_, int capOverflow, HugePages hugePages = HugePages::TRANSPARENT) 
+        : m_Arena(nBlocks_ * PageArena::Footprint(cap * sizeof(Record<T>)) + PageArena::Footprint(capOverflow * sizeof(Record<T>))
+                    + nBlocks_ * sizeof(Block<T>), hugePages),
+          m_Blocks(&m_Arena), OverflowArea(capOverflow, &m_Arena), capacity(cap), maxBlocks(nBlocks_), usedBlocks(0)
+    {
+        m_Blocks.reserve(maxBlocks); // Reserve space for the maximum number of blocks
+        AddBlock(); // Add the first block
+    }
+
+    DataArea(const DataArea&) = delete; // The blocks point to the arena, so the Data Area can't be copied
+    DataArea& operator=(const DataArea&) = delete;
+
+    int getUsedBlocks() { return usedBlocks; } // Get the number of blocks used
+
+    int getMaxBlocks() const { return maxBlocks; } // Get the maximum number of blocks
+
+    const PageArena& getArena() const { return m_Arena; } // Get the arena of the blocks
+
+    std::pmr::vector<Block<T>>& getBlocks() { return m_Blocks; } // Get all the blocks in the Data Area
+
+    Block<T>& getOverflow() { return OverflowArea; } // Get the overflow block
+
+	// Add a new record to the Data Area
+	int AddBlock()
+	{
+        if (usedBlocks < maxBlocks)
+        {
+            m_Blocks.emplace_back(capacity, &m_Arena);
+            return usedBlocks++;
+        }
+
+        return -1; // This means that the Data Area is full (no more blocks can be added)
+	}
+
+    // Add a record built from (key, args...) to the Data Area, the value is built only once on its final place
+    template <typename... Args>
+    std::string AddRecordToData(int index, int key, Args&&... args)
+    {
+        if (index < 0 || index >= usedBlocks) 
+        {
+            return "Error: Invalid block\n";
+        }
+
+        Block<T>& actualBlock = m_Blocks[index]; // Get the actual block
+
+        // Check if the record is trying to be added at the end of the block
+
+        // Get the actual size of the block
+        int actualSize = actualBlock.getRecords().size();
+
+        // Get the records to compare with the new one
+        auto& records = actualBlock.getRecords();
+
+        auto it = std::upper_bound(records.begin(), records.end(), key, [](int k, const auto& b){
+            return k < b.getKey();
+        }); // Find the position to insert the record
+
+        int pos = it - records.begin(); // Get the position of the iterator (it)
+
+        if (pos == actualSize && actualSize >= (capacity + 1)/2) // If the block is full 
+        {
+            // Try to add a new block
+            int index2 = AddBlock();
+
+            if (index2 != -1)
+            {
+                Block<T>& newBlock = m_Blocks[index2];
+                
+                int pos2 = newBlock.EmplaceRecord(key, std::forward<Args>(args)...);
+                
+                if (pos2 < 0)
+                {
+                    return "Error: New block is full";
+                }
+
+                std::string result = "Block " + std::to_string(index2);
+                return result;
+            }
+            else // No more blocks can be added, so the record will be added to the overflow area
+            {
+                return AddOverflow(key, std::forward<Args>(args)...);
+            }
+        }
+        else // If the block is not full
+        {
+            int pos = actualBlock.EmplaceRecord(key, std::forward<Args>(args)...); // Get the position of the new record
+        
+            if (pos >= 0) // If the position is valid and the block is not full
+            {
+                std::string result = "Block " + std::to_string(index);
+                return result;
+            }
+            else
+            {
+                return "Error: Record not added";
+            }
+        }
+
+        // int pos = actualBlock.AddRecord(rec); // Get the position of the new record
+        
+        // if (pos >= 0) // If the position is valid and the block is not full
+        // {
+        //     std::string result = "Block " + std::to_string(index);
+        //     return result;
+        // }
+        // else // If the block is full
+        // {
+        //     // Try to add a new block
+        //     int index2 = AddBlock();
+
+        //     if (index2 != -1)
+        //     {
+        //         Block<T>& newBlock = m_Blocks[index2];
+                
+        //         int pos2 = newBlock.AddRecord(rec);
+                
+        //         if (pos2 < 0)
+        //         {
+        //             return "Error: New block is full";
+        //         }
+
+        //         std::string result = "Block " + std::to_string(index2);
+        //         return result;
+        //     }
+        //     else // No more blocks can be added, so the record will be added to the overflow area
+        //     {
+        //         return AddOverflow(rec);
+        //     } 
+        // }
+    }
+
+    template <typename... Args>
+    std::string AddOverflow(int key, Args&&... args)
+    {
+        if (OverflowArea.IsFull())
+        {
+            return "Error: Overflow is full";
+        }
+
+        // Add the record to the overflow area
+        int pos = OverflowArea.EmplaceRecord(key, std::forward<Args>(args)...);
+        
+        if (pos < 0)
+        {
+            return "Error: Overflow is full, can't be added";
+        }
+        
+        // Update the direction of the previous record
+        UpdateDir(key);
+
+        return "Overflow Block";
+    }
+
+    void UpdateDir(int key)
+    {
+        // I will search for the record previous to the new one
+
+        // Search for the record
+        Record<T>* m_Rec = FindRecord(key);
+
+        if (m_Rec != nullptr)
+        {
+            m_Rec->setDirection(OVER);
+
+            // Mark the block of the record as changed
+            for (auto& block : m_Blocks)
+            {
+                auto& records = block.getRecords();
+
+                if (!records.empty() && m_Rec >= &records.front() && m_Rec <= &records.back())
+                {
+                    block.Touch();
+                    break;
+                }
+            }
+        }
+
+    }
+
+    // Get the current version of each used block and of the overflow area, only the blocks changed
+    // since the last call are copied, the others are shared with the previous snapshots
+    void Publish(std::vector<std::shared_ptr<const Block<T>>>& blocks, std::shared_ptr<const Block<T>>& overflow)
+    {
+        m_Published.resize(usedBlocks);
+
+        for (int i = 0; i < usedBlocks; i++)
+        {
+            if (!m_Published[i] || m_Published[i]->getVersion() != m_Blocks[i].getVersion())
+            {
+                m_Published[i] = std::make_shared<const Block<T>>(m_Blocks[i]);
+            }
+        }
+
+        if (!m_PublishedOverflow || m_PublishedOverflow->getVersion() != OverflowArea.getVersion())
+        {
+            m_PublishedOverflow = std::make_shared<const Block<T>>(OverflowArea);
+        }
+
+        blocks = m_Published;
+        overflow = m_PublishedOverflow;
+    }
+
+    int getPageOf(int index) const { return index + 1; } // Page of a block on the file (page 0 is the file header)
+
+    int getOverflowPage() const { return maxBlocks + 1; } // Page of the overflow area on the file
+
+    // Write the whole Data Area to the file. The header and the blocks are on consecutive pages
+    // (0 to usedBlocks): they are written in runs of CHECKPOINT_RUN pages, with up to
+    // CHECKPOINT_RUNS runs in flight on their own buffers, so the memory doesn't grow with the file.
+    // (sequence) is saved on the header (see Manager::getSequence)
+    bool Checkpoint(BlockFile& file, uint64_t sequence = 0)
+    {
+        int total = usedBlocks + 1;
+        int runPages = std::min(CHECKPOINT_RUN, total);
+
+        std::vector<PageBuffer> buffers;
+        std::vector<char> busy(CHECKPOINT_RUNS, 0);
+
+        for (int i = 0; i < CHECKPOINT_RUNS; i++)
+        {
+            buffers.emplace_back(runPages);
+        }
+
+        FileHeader header = { PAGE_MAGIC, capacity, maxBlocks, usedBlocks, OverflowArea.getCapacity(), 0, sequence };
+        int errors = 0;
+
+        for (int first = 0, run = 0; first < total; first += runPages, run = (run + 1) % CHECKPOINT_RUNS)
+        {
+            while (busy[run])
+            {
+                file.Poll(true); // Wait for the buffer of the run
+            }
+
+            int count = std::min(runPages, total - first);
+
+            for (int page = first; page < first + count; page++)
+            {
+                char* buffer = buffers[run].getPage(page - first);
+
+                if (page == 0)
+                {
+                    std::memset(buffer, 0, BLOCK_PAGE);
+                    std::memcpy(buffer, &header, sizeof(header));
+                    SealFileHeader(buffer);
+                }
+                else if (!EncodePage(m_Blocks[page - 1], page - 1, buffer))
+                {
+                    file.Drain();
+                    return false;
+                }
+            }
+
+            busy[run] = 1;
+
+            file.WriteRunAsync(first, count, buffers[run].getPage(), [&errors, &busy, run, count](int result)
+            {
+                busy[run] = 0;
+
+                if (result != count * BLOCK_PAGE)
+                    errors++;
+            });
+        }
+
+        PageBuffer overflowPage;
+
+        if (!EncodePage(OverflowArea, OVERFLOW_PAGE, overflowPage.getPage()))
+        {
+            file.Drain();
+            return false;
+        }
+
+        file.WriteAsync(getOverflowPage(), overflowPage.getPage(), [&errors](int result) { if (result != BLOCK_PAGE) errors++; });
+
+        file.Drain();
+
+        return errors == 0 && file.Sync();
+    }
+
+    // Read a Data Area written by Checkpoint (this Data Area must be empty and have the same geometry).
+    // (sequence) gets the sequence saved on the header
+    bool Load(BlockFile& file, uint64_t* sequence = nullptr)
+    {
+        PageBuffer headerPage;
+        int result = -1;
+
+        file.ReadAsync(0, headerPage.getPage(), [&result](int res) { result = res; });
+        file.Drain();
+
+        FileHeader header;
+        std::memcpy(&header, headerPage.getPage(), sizeof(header));
+
+        if (result != BLOCK_PAGE || header.magic != PAGE_MAGIC || !CheckFileHeader(headerPage.getPage()) || header.capacity != capacity
+            || header.maxBlocks != maxBlocks || header.usedBlocks < 1 || header.usedBlocks > maxBlocks)
+        {
+            return false;
+        }
+
+        if (sequence != nullptr)
+            *sequence = header.sequence;
+
+        while (usedBlocks < header.usedBlocks)
+        {
+            AddBlock();
+        }
+
+        // The blocks are read in runs of consecutive pages, as Checkpoint writes them
+        int runPages = std::min(CHECKPOINT_RUN, usedBlocks);
+
+        std::vector<PageBuffer> buffers;
+        std::vector<char> busy(CHECKPOINT_RUNS, 0);
+
+        for (int i = 0; i < CHECKPOINT_RUNS; i++)
+        {
+            buffers.emplace_back(runPages);
+        }
+
+        int errors = 0;
+
+        for (int first = 0, run = 0; first < usedBlocks; first += runPages, run = (run + 1) % CHECKPOINT_RUNS)
+        {
+            while (busy[run])
+            {
+                file.Poll(true);
+            }
+
+            int count = std::min(runPages, usedBlocks - first);
+            PageBuffer& buffer = buffers[run];
+
+            busy[run] = 1;
+
+            file.ReadRunAsync(getPageOf(first), count, buffer.getPage(), [this, &errors, &busy, &buffer, run, first, count](int res)
+            {
+                busy[run] = 0;
+
+                for (int i = 0; i < count; i++)
+                {
+                    if (res != count * BLOCK_PAGE || !DecodePage(buffer.getPage(i), first + i, m_Blocks[first + i]))
+                        errors++;
+                }
+            });
+        }
+
+        PageBuffer overflowPage;
+
+        file.ReadAsync(getOverflowPage(), overflowPage.getPage(), [this, &errors, &overflowPage](int res)
+        {
+            if (res != BLOCK_PAGE || !DecodePage(overflowPage.getPage(), OVERFLOW_PAGE, OverflowArea))
+                errors++;
+        });
+
+        file.Drain();
+
+        return errors == 0;
+    }
+
+    Record<T>* FindRecord(int key)
+    {
+        Record<T>* prevRec = nullptr;
+
+        // Search for the record that has the key greater than the new one
+        for (auto& blocks : m_Blocks)
+        {
+            for (auto& rec : blocks.getRecords())
+            {
+                if (rec.getKey() < key)
+                {
+                    if (prevRec == nullptr || rec.getKey() > prevRec->getKey())
+                    {
+                        prevRec = &rec;
+                    }
+                }
+            }
+        }
+
+        return prevRec;
+    }
+};
+
+// -------------------------------------------------------------
+// ----------------- IndexArea Class ---------------------------
+// -------------------------------------------------------------
+
+// How IndexArea::getIndexBlock searches the index
+enum class IndexMode
+{
+    LINEAR, // Scan of the sorted array
+    BINARY, // Binary search of the sorted array
+    TREE, // Balanced tree (std::map) next to the array
+    LEARNED, // Piecewise linear model of the position of the keys, corrected on a small window
+    EYTZINGER, // Keys in BFS order on their own cache aligned array, branchless search with prefetch
+    INTERPOLATION // Interpolation search of the sorted array, guarded by binary steps
+};
+
+#define LEARNED_ERROR 8 // Maximum error (in entries) of the position predicted by a segment of the learned index
+
+template <typename T>
+class IndexArea
+{
+private:
+    std::vector<std::pair<int, int>> key_dir;
+    DataArea<T>* m_Area;
+
+    uint64_t m_Version; // Incremented on each change of the index
+
+    IndexMode m_Mode;
+
+    std::map<int, int> m_Tree; // key -> block (TREE mode)
+
+    int m_Depth; // Entries compared by a search of the tree or of the segments, set when they change
+
+    // Segment of the learned index: the entry of (key) is near start + slope * (key - firstKey)
+    struct Segment
+    {
+        int firstKey;
+        int start;
+        double slope;
+    };
+
+    std::vector<Segment> m_Segments; // LEARNED mode
+
+    // EYTZINGER mode: copy of the keys of key_dir[0, m_EytCount) in BFS order (1-based) and
+    // the position on key_dir of each one. The entries appended later are searched on key_dir
+    // (the tail) until there are enough of them to rebuild
+    std::unique_ptr<int, decltype(&std::free)> m_EytKeys;
+    std::unique_ptr<int, decltype(&std::free)> m_EytPos;
+    int m_EytCount;
+    bool m_EytDirty; // An entry of the BFS part was changed
+
+    static int* AllocAligned(int count)
+    {
+        size_t bytes = ((count * sizeof(int) + 63) / 64) * 64;
+        return (int*)std::aligned_alloc(64, std::max<size_t>(bytes, 64));
+    }
+
+    // Fill the BFS order of the sorted positions, returns the next sorted position
+    int FillEytzinger(int i, int k)
+    {
+        if (k <= m_EytCount)
+        {
+            i = FillEytzinger(i, 2 * k);
+            m_EytKeys.get()[k] = key_dir[i].first;
+            m_EytPos.get()[k] = i++;
+            i = FillEytzinger(i, 2 * k + 1);
+        }
+
+        return i;
+    }
+
+    void BuildEytzinger()
+    {
+        m_EytCount = key_dir.size();
+        m_EytKeys.reset(AllocAligned(m_EytCount + 1));
+        m_EytPos.reset(AllocAligned(m_EytCount + 1));
+        m_EytDirty = false;
+
+        FillEytzinger(0, 1);
+    }
+
+    bool EytzingerStale() const
+    {
+        return m_EytDirty || (int)key_dir.size() - m_EytCount > std::max(64, m_EytCount / 16);
+    }
+
+    int EytzingerUpperBound(int key, int* probes)
+    {
+        int n = key_dir.size();
+
+        if (EytzingerStale())
+        {
+            BuildEytzinger();
+        }
+
+        // The key is on the tail (entries appended after the last build)
+        if (m_EytCount < n && key >= key_dir[m_EytCount].first)
+        {
+            return UpperBound(key, m_EytCount + 1, n, probes);
+        }
+
+        const int* keys = m_EytKeys.get();
+        int k = 1;
+
+        while (k <= m_EytCount)
+        {
+            __builtin_prefetch(keys + k * 16); // The nodes 4 levels below are on this cache line
+            k = 2 * k + (keys[k] <= key); // No branch: go right if the key is not greater
+
+            if (probes != nullptr)
+                (*probes)++;
+        }
+
+        k >>= __builtin_ffs(~k); // Go back up to the first node that is greater than the key
+
+        return (k == 0) ? m_EytCount : m_EytPos.get()[k];
+    }
+
+    // Rebuild the segments that cover the entries from (pos) to the end (greedy shrinking cone)
+    void BuildSegments(int pos)
+    {
+        // Keep the segments that end before (pos)
+        while (!m_Segments.empty() && m_Segments.back().start >= pos)
+        {
+            m_Segments.pop_back();
+        }
+
+        int i = m_Segments.empty() ? 0 : m_Segments.back().start;
+
+        if (!m_Segments.empty())
+        {
+            m_Segments.pop_back(); // The segment of (pos) is rebuilt too
+        }
+
+        int n = key_dir.size();
+
+        while (i < n)
+        {
+            double low = 0.0;
+            double high = 1e300;
+            int j = i + 1;
+
+            for (; j < n; j++)
+            {
+                double dx = (double)key_dir[j].first - key_dir[i].first;
+                double dy = j - i;
+
+                if (dx == 0)
+                {
+                    if (dy > LEARNED_ERROR)
+                        break;
+
+                    continue;
+                }
+
+                double newLow = std::max(low, (dy - LEARNED_ERROR) / dx);
+                double newHigh = std::min(high, (dy + LEARNED_ERROR) / dx);
+
+                if (newLow > newHigh)
+                    break;
+
+                low = newLow;
+                high = newHigh;
+            }
+
+            double slope = (high >= 1e300) ? 0.0 : (low + high) / 2;
+            m_Segments.push_back({ key_dir[i].first, i, slope });
+
+            i = j;
+        }
+    }
+
+    // Position of the first entry with a key greater than (key)
+    int UpperBound(int key, int low, int high, int* probes)
+    {
+        return BinaryUpperBound(key, low, high, [this](int i) { return key_dir[i].first; }, probes);
+    }
+
+    int LearnedUpperBound(int key, int* probes)
+    {
+        int n = key_dir.size();
+
+        // Segment of the key
+        auto seg = std::upper_bound(m_Segments.begin(), m_Segments.end(), key, [](int k, const Segment& s) { return k < s.firstKey; });
+
+        if (probes != nullptr)
+            (*probes) += m_Depth;
+
+        if (seg == m_Segments.begin())
+            return 0;
+
+        --seg;
+
+        long long predicted = seg->start + (long long)(seg->slope * ((double)key - seg->firstKey));
+        int low = (int)std::max(0LL, std::min<long long>(n, predicted - LEARNED_ERROR - 1));
+        int high = (int)std::max(0LL, std::min<long long>(n, predicted + LEARNED_ERROR + 2));
+
+        int pos = UpperBound(key, low, high, probes);
+
+        // Out of the window (key between two segments), fall back to the whole array
+        if ((pos == low && low > 0 && key_dir[low - 1].first > key) || (pos == high && high < n && key_dir[high].first <= key))
+        {
+            pos = UpperBound(key, 0, n, probes);
+        }
+
+        return pos;
+    }
+
+    // Search depth of the structure of the mode (log2 of its size)
+    void UpdateDepth()
+    {
+        size_t size = (m_Mode == IndexMode::TREE) ? m_Tree.size() : m_Segments.size();
+        m_Depth = 1 + (int)std::log2(size + 1);
+    }
+public:
+    IndexArea(DataArea<T>* area) : m_Area(area), m_Version(0), m_Mode(IndexMode::LINEAR), m_Depth(1),
+                                   m_EytKeys(nullptr, &std::free), m_EytPos(nullptr, &std::free), m_EytCount(0), m_EytDirty(false) {}
+
+    uint64_t getVersion() const { return m_Version; }
+
+    std::vector<std::pair<int, int>>& getKeyDir() { return key_dir; }
+
+    IndexMode getMode() const { return m_Mode; }
+
+    // Build now what the next search of the mode would rebuild, so the searches that follow only
+    // read the index (they can run on several threads until it changes again)
+    void Prepare()
+    {
+        if (m_Mode == IndexMode::EYTZINGER && EytzingerStale())
+            BuildEytzinger();
+    }
+
+    // Change how the index is searched (the structures of the new mode are built from the array)
+    void setMode(IndexMode mode)
+    {
+        m_Mode = mode;
+        m_Tree.clear();
+        m_Segments.clear();
+        m_EytKeys.reset();
+        m_EytPos.reset();
+        m_EytCount = 0;
+
+        if (mode == IndexMode::TREE)
+        {
+            for (auto& pair : key_dir)
+                m_Tree[pair.first] = pair.second;
+        }
+        else if (mode == IndexMode::LEARNED)
+        {
+            BuildSegments(0);
+        }
+        else if (mode == IndexMode::EYTZINGER)
+        {
+            BuildEytzinger();
+        }
+
+        UpdateDepth();
+    }
+
+    // Bytes used by the index (the array plus the structures of the mode)
+    size_t MemoryUsage() const
+    {
+        size_t bytes = key_dir.capacity() * sizeof(key_dir[0]);
+
+        if (m_Mode == IndexMode::TREE)
+            bytes += m_Tree.size() * (sizeof(std::pair<const int, int>) + 4 * sizeof(void*)); // Node: value, parent, children and color
+
+        if (m_Mode == IndexMode::LEARNED)
+            bytes += m_Segments.capacity() * sizeof(Segment);
+
+        if (m_Mode == IndexMode::EYTZINGER)
+            bytes += 2 * ((m_EytCount + 1) * sizeof(int) + 63) / 64 * 64;
+
+        return bytes;
+    }
+
+    int getSegments() const { return m_Segments.size(); } // Number of segments of the learned index
+
+    // (probes) returns the number of index entries compared
+    int getIndexBlock(int key, int* probes = nullptr)
+    {
+        if (key_dir.empty()) // Return the first block if the index is empty
+            return 0;
+
+        int pos;
+
+        switch (m_Mode)
+        {
+        case IndexMode::BINARY:
+            pos = UpperBound(key, 0, key_dir.size(), probes);
+            break;
+
+        case IndexMode::TREE:
+        {
+            auto it = m_Tree.upper_bound(key);
+
+            if (probes != nullptr)
+                (*probes) += m_Depth;
+
+            return (it == m_Tree.begin()) ? 0 : std::prev(it)->second;
+        }
+
+        case IndexMode::LEARNED:
+            pos = LearnedUpperBound(key, probes);
+            break;
+
+        case IndexMode::EYTZINGER:
+            pos = EytzingerUpperBound(key, probes);
+            break;
+
+        case IndexMode::INTERPOLATION:
+            pos = InterpolationUpperBound(key, 0, key_dir.size(), [this](int i) { return key_dir[i].first; }, probes);
+            break;
+
+        default:
+        {
+            int indexBlock = 0;
+
+            for (int i = 0; i < key_dir.size(); i++)
+            {
+                if (probes != nullptr)
+                    (*probes)++;
+
+                if (key_dir[i].first <= key)
+                {
+                    indexBlock = key_dir[i].second;
+                }
+                else
+                {
+                    break;
+                }
+            }
+
+            return indexBlock;
+        }
+        }
+
+        return (pos == 0) ? 0 : key_dir[pos - 1].second;
+    }
+
+    void UpdateIndex(int indexBlock, int key)
+    {
+        // Search for the indexBlock in the index (key_dir vector), from the end because the new blocks are the last ones
+        auto rit = std::find_if(key_dir.rbegin(), key_dir.rend(), [indexBlock](auto& pair) { return pair.second == indexBlock; });
+        int pos;
+        int from; // Entries from here were changed
+        int oldKey = key;
+
+        if (rit != key_dir.rend()) // If the indexBlock is found
+        {
+            pos = key_dir.rend() - rit - 1;
+
+            if (key_dir[pos].first == key) // Nothing changes
+            {
+                return;
+            }
+
+            m_Version++;
+
+            oldKey = key_dir[pos].first;
+            key_dir[pos].first = key; // Update the key
+        }
+        else // If the indexBlock is not found
+        {
+            m_Version++;
+
+            key_dir.push_back({ key, indexBlock}); // Add the new key and indexBlock
+            pos = key_dir.size() - 1;
+        }
+
+        from = pos;
+
+        // Move the entry to its place, the rest of the index is already sorted
+        while (pos > 0 && key_dir[pos - 1].first > key_dir[pos].first)
+        {
+            std::swap(key_dir[pos - 1], key_dir[pos]);
+            pos--;
+        }
+
+        while (pos + 1 < (int)key_dir.size() && key_dir[pos + 1].first <= key_dir[pos].first)
+        {
+            std::swap(key_dir[pos + 1], key_dir[pos]);
+            pos++;
+        }
+
+        if (m_Mode == IndexMode::TREE)
+        {
+            // The old key could be the entry of another block too (same first key): its entry
+            // is only removed if it points to this block, then it goes to the block of the last
+            // entry left with that key
+            auto it = m_Tree.find(oldKey);
+
+            if (oldKey != key && it != m_Tree.end() && it->second == indexBlock)
+            {
+                m_Tree.erase(it);
+
+                auto last = std::upper_bound(key_dir.begin(), key_dir.end(), oldKey, [](int k, const auto& entry) { return k < entry.first; });
+
+                if (last != key_dir.begin() && std::prev(last)->first == oldKey)
+                    m_Tree[oldKey] = std::prev(last)->second;
+            }
+
+            m_Tree[key] = indexBlock; // The entry moved after the others with the same key
+            UpdateDepth();
+        }
+
+        if (m_Mode == IndexMode::LEARNED)
+        {
+            BuildSegments(std::min(from, pos));
+            UpdateDepth();
+        }
+
+        if (m_Mode == IndexMode::EYTZINGER && std::min(from, pos) < m_EytCount)
+            m_EytDirty = true; // Rebuilt on the next search, the appends only grow the tail
+    }
+};
+
+// -------------------------------------------------------------
+// ----------------- ReadSnapshot Class ------------------------
+// -------------------------------------------------------------
+
+// Records with keys on [from, to] in key order. The block of an index entry holds the keys up to
+// the next entry, so only the blocks from the last entry before (from) to the last entry on the
+// range are read; (blockOf)(n) returns block n (nullptr if it doesn't exist). The matches of the
+// overflow area are merged with the ones of the blocks
+template <typename T, typename BlockOf>
+std::vector<const Record<T>*> CollectRange(const std::vector<std::pair<int, int>>& keyDir, BlockOf&& blockOf, const Block<T>& overflow, int from, int to)
+{
+    std::vector<const Record<T>*> found;
+
+    if (from > to)
+        return found;
+
+    auto collect = [&](const Block<T>& block)
+    {
+        auto& records = block.getRecords();
+        auto it = std::lower_bound(records.begin(), records.end(), from, [](const auto& rec, int k) { return rec.getKey() < k; });
+
+        for (; it != records.end() && it->getKey() <= to; ++it)
+            found.push_back(&*it);
+    };
+
+    auto it = std::lower_bound(keyDir.begin(), keyDir.end(), from, [](const auto& entry, int k) { return entry.first < k; });
+
+    if (it != keyDir.begin())
+        --it;
+
+    for (; it != keyDir.end() && it->first <= to; ++it)
+    {
+        const Block<T>* block = blockOf(it->second);
+
+        if (block != nullptr)
+            collect(*block);
+    }
+
+    size_t inBlocks = found.size();
+    collect(overflow);
+
+    std::inplace_merge(found.begin(), found.begin() + inBlocks, found.end(), [](auto a, auto b) { return a->getKey() < b->getKey(); });
+
+    return found;
+}
+
+// Read-only, consistent view of a Manager at the moment it was taken (Manager::Snapshot).
+// It holds immutable copies of the blocks (shared with other snapshots while the block
+// doesn't change), so the Manager can keep adding records while it is read from other threads.
+// A version of a block is freed when the last snapshot that uses it is destroyed
+template <typename T>
+class ReadSnapshot
+{
+private:
+    std::vector<std::shared_ptr<const Block<T>>> m_Blocks;
+    std::shared_ptr<const Block<T>> m_Overflow;
+    std::shared_ptr<const std::vector<std::pair<int, int>>> m_KeyDir;
+
+    uint64_t m_Epoch; // Number of the snapshot
+public:
+    ReadSnapshot(std::vector<std::shared_ptr<const Block<T>>> blocks, std::shared_ptr<const Block<T>> overflow,
+                 std::shared_ptr<const std::vector<std::pair<int, int>>> keyDir, uint64_t epoch)
+        : m_Blocks(std::move(blocks)), m_Overflow(std::move(overflow)), m_KeyDir(std::move(keyDir)), m_Epoch(epoch) {}
+
+    uint64_t getEpoch() const { return m_Epoch; }
+
+    int getUsedBlocks() const { return (int)m_Blocks.size(); }
+
+    // Find the record of a key (nullptr if the key is not in the snapshot)
+    const Record<T>* Lookup(int key) const
+    {
+        int indexBlock = 0;
+
+        // Last entry with a key <= (key)
+        auto it = std::upper_bound(m_KeyDir->begin(), m_KeyDir->end(), key, [](int k, const auto& entry) { return k < entry.first; });
+
+        if (it != m_KeyDir->begin())
+            indexBlock = std::prev(it)->second;
+
+        if (indexBlock >= 0 && indexBlock < (int)m_Blocks.size())
+        {
+            int pos = m_Blocks[indexBlock]->Find(key);
+
+            if (pos >= 0)
+                return &m_Blocks[indexBlock]->getRecords()[pos];
+        }
+
+        int pos = m_Overflow->Find(key);
+
+        return (pos >= 0) ? &m_Overflow->getRecords()[pos] : nullptr;
+    }
+
+    bool Find(int key, T& value) const
+    {
+        const Record<T>* rec = Lookup(key);
+
+        if (rec == nullptr)
+            return false;
+
+        value = rec->getValue();
+        return true;
+    }
+
+    // Visit the records with keys on [from, to] in key order
+    void Scan(int from, int to, const std::function<void(const Record<T>&)>& visit) const
+    {
+        auto blockOf = [this](int n) { return (n >= 0 && n < (int)m_Blocks.size()) ? m_Blocks[n].get() : nullptr; };
+
+        for (auto rec : CollectRange<T>(*m_KeyDir, blockOf, *m_Overflow, from, to))
+        {
+            visit(*rec);
+        }
+    }
+};
+
+// -------------------------------------------------------------
+// ----------------- Shared Area Classes -----------------------
+// -------------------------------------------------------------
+
+// A file mapped by several processes: one writer (Manager::Share) copies the index and the
+// changed blocks on it as pages, any number of readers (SharedReader) search it without locks.
+// The index and each page have a sequence counter (seqlock), odd while the writer changes them:
+// a reader copies what it needs and tries again if the counter changed meanwhile.
+// Layout: [SharedHeader] [index entries] [sequences of the pages] [block pages] [overflow page]
+
+#define SHARED_MAGIC 0x49445348 // "IDXH"
+
+struct SharedHeader
+{
+    uint32_t magic;
+    int32_t capacity;
+    int32_t maxBlocks;
+    int32_t overflowCapacity;
+
+    std::atomic<uint64_t> indexSequence; // Seqlock of the index entries and the counters below
+    std::atomic<int32_t> usedBlocks;
+    std::atomic<int32_t> entries; // Entries of the index
+    std::atomic<uint64_t> sequence; // Records of the Manager on the last Share (all of them are visible)
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "The seqlocks of the shared area need lock free atomics");
+
+// First page of each part of the shared file
+struct SharedLayout
+{
+    size_t indexPage;
+    size_t sequencePage;
+    size_t blockPage;
+    size_t pages;
+
+    SharedLayout(int maxBlocks)
+    {
+        indexPage = 1;
+        sequencePage = indexPage + PagesOf(maxBlocks * 2 * sizeof(int32_t));
+        blockPage = sequencePage + PagesOf((maxBlocks + 1) * sizeof(uint64_t));
+        pages = blockPage + maxBlocks + 1; // The last page is the overflow area
+    }
+
+    static size_t PagesOf(size_t bytes) { return (bytes + BLOCK_PAGE - 1) / BLOCK_PAGE; }
+};
+
+// Writer side of a shared file (see Manager::Share)
+class SharedArea
+{
+private:
+    int m_Fd;
+    char* m_Map;
+    SharedLayout m_Layout;
+
+    std::vector<uint64_t> m_Written; // Version of each block on the file (the last one is the overflow area)
+    uint64_t m_IndexWritten;
+
+    SharedHeader* Header() { return (SharedHeader*)m_Map; }
+
+    int32_t* Entries() { return (int32_t*)(m_Map + m_Layout.indexPage * BLOCK_PAGE); }
+
+    std::atomic<uint64_t>& SequenceOf(int slot) { return ((std::atomic<uint64_t>*)(m_Map + m_Layout.sequencePage * BLOCK_PAGE))[slot]; }
+
+    char* PageOf(int slot) { return m_Map + (m_Layout.blockPage + slot) * BLOCK_PAGE; }
+
+    static void BeginWrite(std::atomic<uint64_t>& sequence)
+    {
+        sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    static void EndWrite(std::atomic<uint64_t>& sequence) { sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+public:
+    SharedArea() : m_Fd(-1), m_Map(nullptr), m_Layout(0), m_IndexWritten(UINT64_MAX) {}
+
+    ~SharedArea() { Close(); }
+
+    SharedArea(const SharedArea&) = delete;
+    SharedArea& operator=(const SharedArea&) = delete;
+
+    // Create the file (e.g. on /dev/shm) for a Manager with this geometry
+    bool Create(const std::string& path, int capacity, int maxBlocks, int overflowCapacity)
+    {
+        Close();
+
+        m_Layout = SharedLayout(maxBlocks);
+        m_Fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+        if (m_Fd < 0 || ftruncate(m_Fd, m_Layout.pages * BLOCK_PAGE) != 0)
+        {
+            Close();
+            return false;
+        }
+
+        void* map = mmap(nullptr, m_Layout.pages * BLOCK_PAGE, PROT_READ | PROT_WRITE, MAP_SHARED, m_Fd, 0);
+
+        if (map == MAP_FAILED)
+        {
+            Close();
+            return false;
+        }
+
+        m_Map = (char*)map;
+
+        // The file is zeroed: all the sequences are 0 and the pages are empty
+        SharedHeader* header = new (m_Map) SharedHeader();
+        header->capacity = capacity;
+        header->maxBlocks = maxBlocks;
+        header->overflowCapacity = overflowCapacity;
+        header->indexSequence = 0;
+        header->usedBlocks = 0;
+        header->entries = 0;
+        header->sequence = 0;
+
+        std::atomic_thread_fence(std::memory_order_release);
+        header->magic = SHARED_MAGIC;
+
+        m_Written.assign(maxBlocks + 1, UINT64_MAX);
+        m_IndexWritten = UINT64_MAX;
+
+        return true;
+    }
+
+    void Close()
+    {
+        if (m_Map != nullptr)
+            munmap(m_Map, m_Layout.pages * BLOCK_PAGE);
+
+        if (m_Fd >= 0)
+            close(m_Fd);
+
+        m_Map = nullptr;
+        m_Fd = -1;
+    }
+
+    bool IsOpen() const { return m_Map != nullptr; }
+
+    // Copy the block (OVERFLOW_PAGE for the overflow area) if it changed since it was last written,
+    // returns false if its records don't fit on a page
+    template <typename T>
+    bool WriteBlock(int blockNo, Block<T>& block)
+    {
+        int slot = (blockNo == OVERFLOW_PAGE) ? (int)m_Written.size() - 1 : blockNo;
+
+        if (slot < 0 || slot >= (int)m_Written.size())
+            return false;
+
+        if (m_Written[slot] == block.getVersion())
+            return true;
+
+        PageBuffer page;
+
+        if (!EncodePage(block, blockNo, page.getPage()))
+            return false;
+
+        std::atomic<uint64_t>& sequence = SequenceOf(slot);
+
+        BeginWrite(sequence);
+        std::memcpy(PageOf(slot), page.getPage(), BLOCK_PAGE);
+        EndWrite(sequence);
+
+        m_Written[slot] = block.getVersion();
+
+        return true;
+    }
+
+    // Copy the index if it changed, then make the records up to (sequence) visible
+    bool WriteIndex(const std::vector<std::pair<int, int>>& keyDir, uint64_t version, int usedBlocks, uint64_t sequence)
+    {
+        SharedHeader* header = Header();
+
+        if ((int)keyDir.size() > header->maxBlocks)
+            return false;
+
+        if (m_IndexWritten != version)
+        {
+            BeginWrite(header->indexSequence);
+
+            int32_t* entries = Entries();
+
+            for (size_t i = 0; i < keyDir.size(); i++)
+            {
+                entries[2 * i] = keyDir[i].first;
+                entries[2 * i + 1] = keyDir[i].second;
+            }
+
+            header->entries.store((int32_t)keyDir.size(), std::memory_order_relaxed);
+            header->usedBlocks.store(usedBlocks, std::memory_order_relaxed);
+
+            EndWrite(header->indexSequence);
+
+            m_IndexWritten = version;
+        }
+
+        header->sequence.store(sequence, std::memory_order_release);
+
+        return true;
+    }
+};
+
+// Reader side of a shared file, in any process. The searches don't take locks nor write on the
+// file: each page is copied and used only if its sequence didn't change meanwhile. The pages
+// are read one at a time, so a Scan that runs while the writer shares changes may see the
+// blocks at different moments
+template <typename T>
+class SharedReader
+{
+private:
+    int m_Fd;
+    const char* m_Map;
+    SharedLayout m_Layout;
+
+    PageBuffer m_Page; // Copy of the last page read
+    std::vector<std::pair<int, int>> m_Index; // Copy of the index for the scans
+
+    uint64_t m_Retries; // Reads repeated because the writer changed the data meanwhile
+
+    const SharedHeader* Header() const { return (const SharedHeader*)m_Map; }
+
+    const int32_t* Entries() const { return (const int32_t*)(m_Map + m_Layout.indexPage * BLOCK_PAGE); }
+
+    const std::atomic<uint64_t>& SequenceOf(int slot) const { return ((const std::atomic<uint64_t>*)(m_Map + m_Layout.sequencePage * BLOCK_PAGE))[slot]; }
+
+    // Wait while the writer changes the data of the sequence, returns its value
+    uint64_t BeginRead(const std::atomic<uint64_t>& sequence)
+    {
+        uint64_t value = sequence.load(std::memory_order_acquire);
+
+        while (value & 1)
+        {
+            m_Retries++;
+            std::this_thread::yield();
+            value = sequence.load(std::memory_order_acquire);
+        }
+
+        return value;
+    }
+
+    bool EndRead(const std::atomic<uint64_t>& sequence, uint64_t value)
+    {
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (sequence.load(std::memory_order_relaxed) == value)
+            return true;
+
+        m_Retries++;
+        return false;
+    }
+
+    // Copy the page of the block (or of the overflow area, slot maxBlocks) on m_Page
+    void ReadPage(int slot)
+    {
+        const std::atomic<uint64_t>& sequence = SequenceOf(slot);
+        const char* page = m_Map + (m_Layout.blockPage + slot) * BLOCK_PAGE;
+
+        while (true)
+        {
+            uint64_t value = BeginRead(sequence);
+            std::memcpy(m_Page.getPage(), page, BLOCK_PAGE);
+
+            if (EndRead(sequence, value))
+                return;
+        }
+    }
+
+    // Find the key on m_Page
+    bool FindOnPage(int key, T& value)
+    {
+        bool found = false;
+
+        // A page never written is all zeros, VisitPage sees it as not valid (no records)
+        VisitPage(m_Page.getPage(), [&](int k, int, const char* bytes, size_t length)
+        {
+            if (k != key)
+                return k < key;
+
+            value = DecodeValue<T>(bytes, length, std::pmr::polymorphic_allocator<std::byte>());
+            found = true;
+
+            return false;
+        });
+
+        return found;
+    }
+public:
+    SharedReader() : m_Fd(-1), m_Map(nullptr), m_Layout(0), m_Retries(0) {}
+
+    ~SharedReader() { Close(); }
+
+    SharedReader(const SharedReader&) = delete;
+    SharedReader& operator=(const SharedReader&) = delete;
+
+    // Attach to a file created by SharedArea::Create (read only)
+    bool Open(const std::string& path)
+    {
+        Close();
+
+        m_Fd = open(path.c_str(), O_RDONLY);
+
+        int32_t fields[4]; // magic, capacity, maxBlocks, overflowCapacity
+
+        if (m_Fd < 0 || pread(m_Fd, fields, sizeof(fields), 0) != sizeof(fields) || (uint32_t)fields[0] != SHARED_MAGIC || fields[2] < 1)
+        {
+            Close();
+            return false;
+        }
+
+        m_Layout = SharedLayout(fields[2]);
+
+        void* map = mmap(nullptr, m_Layout.pages * BLOCK_PAGE, PROT_READ, MAP_SHARED, m_Fd, 0);
+
+        if (map == MAP_FAILED)
+        {
+            Close();
+            return false;
+        }
+
+        m_Map = (const char*)map;
+
+        return true;
+    }
+
+    void Close()
+    {
+        if (m_Map != nullptr)
+            munmap((void*)m_Map, m_Layout.pages * BLOCK_PAGE);
+
+        if (m_Fd >= 0)
+            close(m_Fd);
+
+        m_Map = nullptr;
+        m_Fd = -1;
+    }
+
+    bool IsOpen() const { return m_Map != nullptr; }
+
+    uint64_t getSequence() const { return Header()->sequence.load(std::memory_order_acquire); } // Records visible to the readers
+
+    uint64_t getRetries() const { return m_Retries; }
+
+    bool Find(int key, T& value)
+    {
+        const SharedHeader* header = Header();
+        int block = 0;
+
+        // Last index entry with a key not greater than (key)
+        while (true)
+        {
+            uint64_t sequence = BeginRead(header->indexSequence);
+
+            int entries = std::min(header->entries.load(std::memory_order_relaxed), header->maxBlocks);
+            int used = header->usedBlocks.load(std::memory_order_relaxed);
+            int pos = BinaryUpperBound(key, 0, entries, [this](int i) { return Entries()[2 * i]; }, nullptr);
+
+            block = (entries == 0) ? -1 : Entries()[2 * std::max(pos - 1, 0) + 1]; // Keys before the first entry are on its block
+
+            if (EndRead(header->indexSequence, sequence))
+            {
+                if (block >= used)
+                    block = -1;
+
+                break;
+            }
+        }
+
+        if (block >= 0)
+        {
+            ReadPage(block);
+
+            if (FindOnPage(key, value))
+                return true;
+        }
+
+        ReadPage(header->maxBlocks);
+
+        return FindOnPage(key, value);
+    }
+
+    // Visit the records with keys on [from, to] in key order
+    void Scan(int from, int to, const std::function<void(int, const T&)>& visit)
+    {
+        const SharedHeader* header = Header();
+
+        while (true)
+        {
+            uint64_t sequence = BeginRead(header->indexSequence);
+
+            int entries = std::min(header->entries.load(std::memory_order_relaxed), header->maxBlocks);
+            m_Index.resize(entries);
+
+            for (int i = 0; i < entries; i++)
+                m_Index[i] = { Entries()[2 * i], Entries()[2 * i + 1] };
+
+            if (EndRead(header->indexSequence, sequence))
+                break;
+        }
+
+        std::vector<std::pair<int, T>> found;
+
+        auto collect = [&](int slot)
+        {
+            ReadPage(slot);
+
+            VisitPage(m_Page.getPage(), [&](int key, int, const char* bytes, size_t length)
+            {
+                if (key >= from && key <= to)
+                    found.emplace_back(key, DecodeValue<T>(bytes, length, std::pmr::polymorphic_allocator<std::byte>()));
+
+                return key <= to;
+            });
+        };
+
+        // The block of an index entry holds the keys up to the next entry
+        auto it = std::lower_bound(m_Index.begin(), m_Index.end(), from, [](const auto& entry, int k) { return entry.first < k; });
+
+        if (it != m_Index.begin())
+            --it;
+
+        for (; it != m_Index.end() && it->first <= to; ++it)
+        {
+            if (it->second >= 0 && it->second < header->maxBlocks)
+                collect(it->second);
+        }
+
+        collect(header->maxBlocks);
+
+        std::stable_sort(found.begin(), found.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+        for (auto& rec : found)
+        {
+            visit(rec.first, rec.second);
+        }
+    }
+};
+
+// -------------------------------------------------------------
+// ----------------- Stats Classes -----------------------------
+// -------------------------------------------------------------
+
+// Latency histogram with log-linear buckets (HDR style): each power of two
+// is split in 2^SUB_BITS sub-buckets, so the relative error is ~1/2^SUB_BITS
+class LatencyHistogram
+{
+private:
+    static const int SUB_BITS = 3;
+    static const int SUB_BUCKETS = 1 << SUB_BITS;
+    static const int BUCKETS = 64 * SUB_BUCKETS;
+
+    std::atomic<uint64_t> m_Buckets[BUCKETS];
+
+    static int BucketOf(uint64_t value)
+    {
+        if (value < SUB_BUCKETS)
+            return (int)value;
+
+        int msb = 63 - __builtin_clzll(value); // Position of the most significant bit
+        int sub = (int)((value >> (msb - SUB_BITS)) & (SUB_BUCKETS - 1));
+
+        return (msb - SUB_BITS + 1) * SUB_BUCKETS + sub;
+    }
+
+    static uint64_t UpperBoundOf(int bucket)
+    {
+        if (bucket < SUB_BUCKETS)
+            return (uint64_t)bucket;
+
+        int msb = bucket / SUB_BUCKETS + SUB_BITS - 1;
+        uint64_t sub = bucket % SUB_BUCKETS;
+
+        return ((SUB_BUCKETS + sub + 1) << (msb - SUB_BITS)) - 1;
+    }
+public:
+    LatencyHistogram() { Reset(); }
+
+    void Record(uint64_t value) { m_Buckets[BucketOf(value)].fetch_add(1, std::memory_order_relaxed); }
+
+    void Reset()
+    {
+        for (auto& bucket : m_Buckets)
+            bucket.store(0, std::memory_order_relaxed);
+    }
+
+    uint64_t Count() const
+    {
+        uint64_t total = 0;
+
+        for (auto& bucket : m_Buckets)
+            total += bucket.load(std::memory_order_relaxed);
+
+        return total;
+    }
+
+    // Get the value under which (p) percent of the samples are (upper bound of the bucket)
+    uint64_t Percentile(double p) const
+    {
+        uint64_t total = Count();
+
+        if (total == 0)
+            return 0;
+
+        uint64_t target = (uint64_t)(total * p / 100.0);
+        uint64_t seen = 0;
+
+        for (int i = 0; i < BUCKETS; i++)
+        {
+            seen += m_Buckets[i].load(std::memory_order_relaxed);
+
+            if (seen > target)
+                return UpperBoundOf(i);
+        }
+
+        return UpperBoundOf(BUCKETS - 1);
+    }
+};
+
+// Counters striped by thread, each thread adds to its own cache line with relaxed atomics
+class StatCounters
+{
+public:
+    enum Counter { INDEX_PROBES, RECORDS_COMPARED, SEARCHES, ADDS, OVERFLOW_HITS, OVERFLOW_MISSES, CACHE_HITS, CACHE_MISSES, BUFFER_HITS, FLUSHES, FLUSH_REJECTED, CHECKSUM_ERRORS, COUNTERS };
+private:
+    static const int STRIPES = 16;
+
+    struct alignas(64) Stripe
+    {
+        std::atomic<uint64_t> values[COUNTERS];
+    };
+
+    Stripe m_Stripes[STRIPES];
+
+    static int StripeOf()
+    {
+        static std::atomic<int> next(0);
+        thread_local int stripe = next.fetch_add(1, std::memory_order_relaxed) % STRIPES;
+        return stripe;
+    }
+public:
+    StatCounters() { Reset(); }
+
+    void Add(Counter counter, uint64_t value = 1)
+    {
+        m_Stripes[StripeOf()].values[counter].fetch_add(value, std::memory_order_relaxed);
+    }
+
+    uint64_t Get(Counter counter) const
+    {
+        uint64_t total = 0;
+
+        for (auto& stripe : m_Stripes)
+            total += stripe.values[counter].load(std::memory_order_relaxed);
+
+        return total;
+    }
+
+    void Reset()
+    {
+        for (auto& stripe : m_Stripes)
+            for (auto& value : stripe.values)
+                value.store(0, std::memory_order_relaxed);
+    }
+};
+
+// Snapshot of the metrics of a Manager (returned by Manager::Stats)
+struct ManagerStats
+{
+    uint64_t adds = 0;
+    uint64_t searches = 0;
+    uint64_t indexProbes = 0; // Index entries compared by all the searches
+    uint64_t recordsCompared = 0; // Records compared by all the searches
+    uint64_t overflowHits = 0; // Searches resolved in the overflow area
+    uint64_t overflowMisses = 0; // Searches that scanned the overflow area without finding the key
+    uint64_t cacheHits = 0; // Finds answered by the hot key cache
+    uint64_t cacheMisses = 0;
+    size_t cacheCapacity = 0; // 0 if the cache is disabled
+    uint64_t bufferHits = 0; // Searches answered by the write buffer
+    uint64_t flushes = 0;
+    uint64_t flushRejected = 0; // Buffered records that didn't fit on the blocks when flushed
+    size_t bufferSize = 0;
+    size_t bufferCapacity = 0; // 0 if the write buffer is disabled
+    uint64_t checksumErrors = 0; // Pages read from a file with a wrong checksum
+    size_t arenaBytes = 0; // Memory mapped by the arena of the blocks
+    size_t arenaHugeBytes = 0; // Part of it on huge pages
+
+    int usedBlocks = 0;
+    int maxBlocks = 0;
+    int indexEntries = 0;
+    int overflowSize = 0;
+    int overflowCapacity = 0;
+
+    // Latencies in nanoseconds
+    uint64_t addP50 = 0, addP99 = 0, addP999 = 0;
+    uint64_t searchP50 = 0, searchP99 = 0, searchP999 = 0;
+
+    double RecordsPerSearch() const { return searches ? (double)recordsCompared / searches : 0.0; }
+    double OverflowHitRate() const { return (overflowHits + overflowMisses) ? (double)overflowHits / (overflowHits + overflowMisses) : 0.0; }
+    double CacheHitRate() const { return (cacheHits + cacheMisses) ? (double)cacheHits / (cacheHits + cacheMisses) : 0.0; }
+};
+
+// Record the time elapsed in its scope on a histogram (without the time of the LatencyPause
+// scopes opened inside it on the same thread)
+class ScopedLatency
+{
+private:
+    LatencyHistogram& m_Histogram;
+    std::chrono::steady_clock::time_point m_Start;
+    std::chrono::steady_clock::duration m_Paused;
+    ScopedLatency* m_Outer; // Timer of the same thread this one is nested in
+
+    // Innermost timer running on this thread
+    static ScopedLatency*& Current()
+    {
+        static thread_local ScopedLatency* current = nullptr;
+        return current;
+    }
+
+    friend class LatencyPause;
+public:
+    ScopedLatency(LatencyHistogram& histogram) : m_Histogram(histogram), m_Start(std::chrono::steady_clock::now()), m_Paused(0), m_Outer(Current())
+    {
+        Current() = this;
+    }
+
+    ScopedLatency(const ScopedLatency&) = delete;
+    ScopedLatency& operator=(const ScopedLatency&) = delete;
+
+    ~ScopedLatency()
+    {
+        Current() = m_Outer;
+
+        auto elapsed = std::chrono::steady_clock::now() - m_Start - m_Paused;
+        m_Histogram.Record(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    }
+};
+
+// Stop the timers of the thread in its scope (the output printed by the timed operations)
+class LatencyPause
+{
+private:
+    std::chrono::steady_clock::time_point m_Start;
+public:
+    LatencyPause() : m_Start(std::chrono::steady_clock::now()) {}
+
+    LatencyPause(const LatencyPause&) = delete;
+    LatencyPause& operator=(const LatencyPause&) = delete;
+
+    ~LatencyPause()
+    {
+        auto paused = std::chrono::steady_clock::now() - m_Start;
+
+        for (ScopedLatency* timer = ScopedLatency::Current(); timer != nullptr; timer = timer->m_Outer)
+            timer->m_Paused += paused;
+    }
+};
+
+// -------------------------------------------------------------
+// ----------------- Export Classes ----------------------------
+// -------------------------------------------------------------
+
+enum class ExportFormat { CSV, BINARY };
+
+#define EXPORT_MAGIC 0x45584449 // "IDXE", first 4 bytes of a binary export
+
+// Writes to a file through one big buffer (one system call per buffer, not per record)
+class ExportWriter
+{
+private:
+    int m_Fd;
+    std::vector<char> m_Buffer;
+    size_t m_Used;
+    bool m_Failed;
+public:
+    ExportWriter(size_t bufferSize) : m_Fd(-1), m_Buffer(std::max<size_t>(bufferSize, 64)), m_Used(0), m_Failed(false) {}
+
+    ~ExportWriter() { Close(); }
+
+    ExportWriter(const ExportWriter&) = delete;
+    ExportWriter& operator=(const ExportWriter&) = delete;
+
+    bool Open(const std::string& path)
+    {
+        m_Fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        m_Failed = (m_Fd < 0);
+
+        return !m_Failed;
+    }
+
+    // Flush and close the file, returns false if any write failed
+    bool Close()
+    {
+        if (m_Fd >= 0)
+        {
+            Flush();
+            close(m_Fd);
+            m_Fd = -1;
+        }
+
+        return !m_Failed;
+    }
+
+    void Flush()
+    {
+        size_t done = 0;
+
+        while (done < m_Used && !m_Failed)
+        {
+            ssize_t result = write(m_Fd, m_Buffer.data() + done, m_Used - done);
+
+            if (result < 0 && errno == EINTR)
+                continue;
+
+            if (result <= 0)
+                m_Failed = true;
+            else
+                done += result;
+        }
+
+        m_Used = 0;
+    }
+
+    void Write(const char* data, size_t length)
+    {
+        if (m_Used + length > m_Buffer.size())
+        {
+            Flush();
+
+            // Bigger than the whole buffer: write it directly
+            if (length > m_Buffer.size())
+            {
+                while (length > 0 && !m_Failed)
+                {
+                    ssize_t result = write(m_Fd, data, length);
+
+                    if (result < 0 && errno == EINTR)
+                        continue;
+
+                    if (result <= 0)
+                    {
+                        m_Failed = true;
+                        break;
+                    }
+
+                    data += result;
+                    length -= result;
+                }
+
+                return;
+            }
+        }
+
+        std::memcpy(m_Buffer.data() + m_Used, data, length);
+        m_Used += length;
+    }
+
+    template <typename V>
+    void WriteRaw(const V& value) { Write((const char*)&value, sizeof(V)); }
+
+    void WriteInt(long long value)
+    {
+        char digits[24];
+        int length = std::snprintf(digits, sizeof(digits), "%lld", value);
+
+        Write(digits, length);
+    }
+
+    // Write the first bytes of the file for the format
+    void WriteHeader(ExportFormat format)
+    {
+        if (format == ExportFormat::BINARY)
+        {
+            WriteRaw<uint32_t>(EXPORT_MAGIC);
+        }
+        else
+        {
+            const char header[] = "key,value,direction\n";
+            Write(header, sizeof(header) - 1);
+        }
+    }
+
+    // CSV: key,value,direction (the value is quoted if it needs it)
+    // Binary: key, direction, length of the value (int32) and the bytes of the value
+    template <typename T>
+    void WriteRecord(ExportFormat format, const Record<T>& rec)
+    {
+        size_t length;
+        const char* bytes = ValueBytes(rec.getValue(), length);
+
+        if (format == ExportFormat::BINARY)
+        {
+            int32_t fields[3] = { rec.getKey(), rec.getDirection(), (int32_t)length };
+
+            WriteRaw(fields);
+            Write(bytes, length);
+            return;
+        }
+
+        WriteInt(rec.getKey());
+        Write(",", 1);
+
+        if constexpr (std::is_floating_point_v<T>)
+        {
+            // Shortest text that reads back the same value
+            char digits[64];
+            auto result = std::to_chars(digits, digits + sizeof(digits), rec.getValue());
+
+            Write(digits, result.ptr - digits);
+        }
+        else if constexpr (std::is_arithmetic_v<T>)
+        {
+            WriteInt((long long)rec.getValue());
+        }
+        else if (std::find_if(bytes, bytes + length, [](char c) { return c == ',' || c == '"' || c == '\n'; }) != bytes + length)
+        {
+            Write("\"", 1);
+
+            for (size_t i = 0; i < length; i++)
+            {
+                if (bytes[i] == '"')
+                    Write("\"", 1);
+
+                Write(bytes + i, 1);
+            }
+
+            Write("\"", 1);
+        }
+        else
+        {
+            Write(bytes, length);
+        }
+
+        Write(",", 1);
+        WriteInt(rec.getDirection());
+        Write("\n", 1);
+    }
+};
+
+// -------------------------------------------------------------
+// ----------------- Import Classes ----------------------------
+// -------------------------------------------------------------
+
+// Read-only memory mapping of a whole file
+class MappedFile
+{
+private:
+    const char* m_Data;
+    size_t m_Size;
+public:
+    MappedFile() : m_Data(nullptr), m_Size(0) {}
+
+    ~MappedFile() { Close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool Open(const std::string& path)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+
+        if (fd < 0)
+        {
+            return false;
+        }
+
+        off_t size = lseek(fd, 0, SEEK_END);
+
+        if (size > 0)
+        {
+            void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+
+            if (data != MAP_FAILED)
+            {
+                madvise(data, size, MADV_SEQUENTIAL);
+                m_Data = (const char*)data;
+                m_Size = size;
+            }
+        }
+
+        close(fd);
+
+        return size == 0 || m_Data != nullptr;
+    }
+
+    void Close()
+    {
+        if (m_Data != nullptr)
+            munmap((void*)m_Data, m_Size);
+
+        m_Data = nullptr;
+        m_Size = 0;
+    }
+
+    const char* getData() const { return m_Data; }
+
+    size_t getSize() const { return m_Size; }
+};
+
+// Record parsed from an input file, the value points into the mapping (or into the
+// unescaped copies of its chunk)
+struct ParsedRecord
+{
+    int key;
+    const char* bytes;
+    uint32_t length;
+
+    bool operator<(const ParsedRecord& other) const { return key < other.key; }
+};
+
+// Records of a chunk of the input, sorted by key
+struct ParsedRun
+{
+    std::vector<ParsedRecord> records;
+    std::deque<std::string> unescaped; // Owns the quoted values with "" inside
+    size_t errors = 0;
+};
+
+// Parse the CSV lines of [begin, end) (key,value[,direction]), the lines that can't be parsed are skipped.
+// A quoted value can hold new lines, its line ends on the first new line after the closing quote
+inline void ParseCsvChunk(const char* begin, const char* end, ParsedRun& run)
+{
+    const char* p = begin;
+
+    while (p < end)
+    {
+        const char* lineEnd = (const char*)std::memchr(p, '\n', end - p);
+
+        if (lineEnd == nullptr)
+            lineEnd = end;
+
+        int key;
+        auto parsed = std::from_chars(p, lineEnd, key);
+
+        if (parsed.ec != std::errc() || parsed.ptr >= lineEnd || *parsed.ptr != ',')
+        {
+            if (lineEnd > p)
+                run.errors++;
+
+            p = lineEnd + 1;
+            continue;
+        }
+
+        const char* value = parsed.ptr + 1;
+
+        if (value < lineEnd && *value == '"')
+        {
+            // Quoted value, "" is an escaped quote
+            std::string text;
+            const char* q = value + 1;
+
+            while (q < end && !(*q == '"' && (q + 1 >= end || q[1] != '"')))
+            {
+                text += *q;
+                q += (*q == '"') ? 2 : 1;
+            }
+
+            if (text.size() == (size_t)(q - value - 1))
+            {
+                run.records.push_back({ key, value + 1, (uint32_t)text.size() });
+            }
+            else
+            {
+                run.unescaped.push_back(std::move(text));
+                run.records.push_back({ key, run.unescaped.back().data(), (uint32_t)run.unescaped.back().size() });
+            }
+
+            lineEnd = (q < end) ? (const char*)std::memchr(q, '\n', end - q) : nullptr;
+
+            if (lineEnd == nullptr)
+                lineEnd = end;
+        }
+        else
+        {
+            // The value ends on the next comma (the direction is not imported)
+            const char* valueEnd = std::find(value, lineEnd, ',');
+
+            if (valueEnd == lineEnd && lineEnd > value && lineEnd[-1] == '\r')
+                valueEnd--;
+
+            run.records.push_back({ key, value, (uint32_t)(valueEnd - value) });
+        }
+
+        p = lineEnd + 1;
+    }
+
+    std::sort(run.records.begin(), run.records.end());
+}
+
+// -------------------------------------------------------------
+// ----------------- WorkStealingPool Class --------------------
+// -------------------------------------------------------------
+
+// Thread pool where each worker has its own queue of tasks: a worker takes the newest
+// task of its own queue and, when it is empty, steals the oldest task of another worker
+class WorkStealingPool
+{
+private:
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<Worker>> m_Workers;
+    std::vector<std::thread> m_Threads;
+
+    std::mutex m_Mutex; // Only used to sleep when there is nothing to do
+    std::condition_variable m_Ready;
+    std::atomic<int> m_Pending;
+    std::atomic<unsigned> m_Next;
+    bool m_Stop;
+
+    static int& WorkerId()
+    {
+        thread_local int id = -1;
+        return id;
+    }
+
+    bool TryPop(int id, std::function<void()>& task)
+    {
+        // Own queue first (LIFO)
+        {
+            Worker& own = *m_Workers[id];
+            std::lock_guard<std::mutex> lock(own.mutex);
+
+            if (!own.tasks.empty())
+            {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+
+        // Steal from the others (FIFO)
+        for (size_t i = 1; i < m_Workers.size(); i++)
+        {
+            Worker& other = *m_Workers[(id + i) % m_Workers.size()];
+            std::lock_guard<std::mutex> lock(other.mutex);
+
+            if (!other.tasks.empty())
+            {
+                task = std::move(other.tasks.front());
+                other.tasks.pop_front();
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void Run(int id)
+    {
+        WorkerId() = id;
+
+        while (true)
+        {
+            std::function<void()> task;
+
+            if (TryPop(id, task))
+            {
+                m_Pending--;
+                task();
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            m_Ready.wait(lock, [this] { return m_Stop || m_Pending > 0; });
+
+            if (m_Stop && m_Pending == 0)
+                return;
+        }
+    }
+public:
+    WorkStealingPool(int threads = std::max(1u, std::thread::hardware_concurrency())) : m_Pending(0), m_Next(0), m_Stop(false)
+    {
+        for (int i = 0; i < threads; i++)
+        {
+            m_Workers.push_back(std::make_unique<Worker>());
+        }
+
+        for (int i = 0; i < threads; i++)
+        {
+            m_Threads.emplace_back(&WorkStealingPool::Run, this, i);
+        }
+    }
+
+    ~WorkStealingPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_Stop = true;
+        }
+
+        m_Ready.notify_all();
+
+        for (auto& thread : m_Threads)
+        {
+            thread.join();
+        }
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    int getThreads() const { return (int)m_Threads.size(); }
+
+    // Queue a task, on the queue of the calling worker or round robin if it is not a worker of the pool
+    void Submit(std::function<void()> task)
+    {
+        int id = WorkerId();
+
+        if (id < 0 || id >= (int)m_Workers.size())
+        {
+            id = m_Next++ % m_Workers.size();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_Workers[id]->mutex);
+            m_Workers[id]->tasks.push_back(std::move(task));
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_Pending++;
+        }
+
+        m_Ready.notify_one();
+    }
+
+    // Run (fn)(i) for i in [0, count) on the pool and wait until all are done. Called from a task
+    // of the pool, the worker runs the queued tasks while it waits (all the workers could be
+    // waiting on nested calls, with their tasks still on the queues)
+    void ParallelFor(int count, const std::function<void(int)>& fn)
+    {
+        int left = count;
+        std::mutex doneMutex;
+        std::condition_variable done;
+
+        for (int i = 0; i < count; i++)
+        {
+            Submit([&, i]
+            {
+                fn(i);
+
+                // The count changes and the waiter is woken under the lock: the waiter can't
+                // return (and destroy doneMutex and done) while a task still uses them
+                std::lock_guard<std::mutex> lock(doneMutex);
+
+                if (--left == 0)
+                    done.notify_one();
+            });
+        }
+
+        int id = WorkerId();
+
+        if (id >= 0 && id < (int)m_Workers.size())
+        {
+            std::unique_lock<std::mutex> lock(doneMutex);
+
+            while (left > 0)
+            {
+                lock.unlock();
+
+                std::function<void()> task;
+
+                if (TryPop(id, task))
+                {
+                    m_Pending--;
+                    task();
+                    lock.lock();
+                    continue;
+                }
+
+                // The last tasks run on other workers: wake up when they end, or to look
+                // for the tasks they queue meanwhile
+                lock.lock();
+                done.wait_for(lock, std::chrono::milliseconds(1), [&left] { return left == 0; });
+            }
+
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(doneMutex);
+        done.wait(lock, [&left] { return left == 0; });
+    }
+
+    // Pool shared by the parallel scans
+    static WorkStealingPool& Default()
+    {
+        static WorkStealingPool pool;
+        return pool;
+    }
+};
+
+// -------------------------------------------------------------
+// ----------------- Verify Function ---------------------------
+// -------------------------------------------------------------
+
+// Check the header and the pages of a file written by Checkpoint without loading it: the runs of
+// pages are read and checked in parallel. Returns the number of bad pages (and their numbers on
+// (bad)), -1 if the file can't be read. A damaged header is the only bad page reported (0): its
+// number of pages and geometry can't be trusted
+long long VerifyFile(const std::string& path, std::vector<int>* bad = nullptr, WorkStealingPool& pool = WorkStealingPool::Default())
+{
+    int fd = open(path.c_str(), O_RDONLY);
+
+    if (fd < 0)
+        return -1;
+
+    PageBuffer headerPage;
+    FileHeader header;
+
+    ssize_t result = pread(fd, headerPage.getPage(), BLOCK_PAGE, 0);
+    std::memcpy(&header, headerPage.getPage(), sizeof(header));
+
+    if (result != BLOCK_PAGE)
+    {
+        close(fd);
+        return -1;
+    }
+
+    if (!CheckFileHeader(headerPage.getPage()) || header.magic != PAGE_MAGIC || header.usedBlocks < 0 || header.usedBlocks > header.maxBlocks)
+    {
+        close(fd);
+
+        if (bad != nullptr)
+            *bad = { 0 };
+
+        return 1;
+    }
+
+    std::vector<int> badPages;
+    std::mutex mutex;
+
+    // Runs of the block pages (1 .. usedBlocks), the last run is the page of the overflow area
+    int runs = (header.usedBlocks + CHECKPOINT_RUN - 1) / CHECKPOINT_RUN + 1;
+
+    pool.ParallelFor(runs, [&](int run)
+    {
+        bool overflow = (run == runs - 1);
+        int first = overflow ? header.maxBlocks + 1 : 1 + run * CHECKPOINT_RUN;
+        int count = overflow ? 1 : std::min(CHECKPOINT_RUN, header.usedBlocks + 1 - first);
+
+        PageBuffer buffer(count);
+        ssize_t read = pread(fd, buffer.getPage(), (size_t)count * BLOCK_PAGE, (off_t)first * BLOCK_PAGE);
+
+        for (int i = 0; i < count; i++)
+        {
+            PageHeader page;
+            std::memcpy(&page, buffer.getPage(i), sizeof(page));
+
+            bool valid = read >= (ssize_t)(i + 1) * BLOCK_PAGE && page.block == (overflow ? OVERFLOW_PAGE : first + i - 1)
+                && CheckPage(buffer.getPage(i));
+
+            if (!valid)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                badPages.push_back(first + i);
+            }
+        }
+    });
+
+    close(fd);
+
+    std::sort(badPages.begin(), badPages.end());
+
+    if (bad != nullptr)
+        *bad = badPages;
+
+    return (long long)badPages.size();
+}
+
+// -------------------------------------------------------------
+// ----------------- HotKeyCache Class -------------------------
+// -------------------------------------------------------------
+
+// Bounded cache of the values of the most read keys (Manager::setCache). The keys are spread
+// over shards with their own lock, each shard evicts with the CLOCK algorithm: a read marks
+// the slot as referenced and the hand gives a second chance to the referenced slots
+template <typename T>
+class HotKeyCache
+{
+private:
+    struct Slot
+    {
+        int key = 0;
+        std::optional<T> value; // Empty slot if it has no value
+        bool referenced = false;
+    };
+
+    struct Shard
+    {
+        std::mutex lock;
+        std::vector<Slot> slots;
+        std::unordered_map<int, int> where; // key -> slot
+        size_t hand = 0;
+    };
+
+    std::vector<std::unique_ptr<Shard>> m_Shards;
+    size_t m_Capacity;
+
+    Shard& ShardOf(int key)
+    {
+        uint32_t hash = (uint32_t)key * 2654435761u; // Consecutive keys go to different shards
+        return *m_Shards[(hash >> 16) % m_Shards.size()];
+    }
+public:
+    HotKeyCache(size_t entries, int shards = 8) : m_Capacity(0)
+    {
+        shards = std::max(1, std::min<int>(shards, (int)std::max<size_t>(1, entries)));
+
+        for (int i = 0; i < shards; i++)
+        {
+            m_Shards.push_back(std::make_unique<Shard>());
+            m_Shards.back()->slots.resize(entries / shards + (i < (int)(entries % shards) ? 1 : 0));
+            m_Shards.back()->where.reserve(m_Shards.back()->slots.size());
+            m_Capacity += m_Shards.back()->slots.size();
+        }
+    }
+
+    size_t getCapacity() const { return m_Capacity; }
+
+    // Copy the cached value of a key on (value), returns false if it is not cached
+    bool Get(int key, T& value)
+    {
+        Shard& shard = ShardOf(key);
+        std::lock_guard<std::mutex> guard(shard.lock);
+
+        auto it = shard.where.find(key);
+
+        if (it == shard.where.end())
+            return false;
+
+        Slot& slot = shard.slots[it->second];
+        slot.referenced = true;
+        value = *slot.value;
+
+        return true;
+    }
+
+    void Put(int key, const T& value)
+    {
+        Shard& shard = ShardOf(key);
+        std::lock_guard<std::mutex> guard(shard.lock);
+
+        if (shard.slots.empty())
+            return;
+
+        auto it = shard.where.find(key);
+
+        if (it != shard.where.end())
+        {
+            shard.slots[it->second].value = value;
+            shard.slots[it->second].referenced = true;
+            return;
+        }
+
+        // Move the hand until an empty or not referenced slot (at most two turns)
+        while (true)
+        {
+            Slot& slot = shard.slots[shard.hand];
+
+            if (!slot.value || !slot.referenced)
+                break;
+
+            slot.referenced = false;
+            shard.hand = (shard.hand + 1) % shard.slots.size();
+        }
+
+        Slot& victim = shard.slots[shard.hand];
+
+        if (victim.value)
+            shard.where.erase(victim.key);
+
+        victim.key = key;
+        victim.value = value;
+        victim.referenced = false; // It must be read again to survive the next turn of the hand
+
+        shard.where[key] = shard.hand;
+        shard.hand = (shard.hand + 1) % shard.slots.size();
+    }
+
+    // Forget a key (its record changed)
+    void Erase(int key)
+    {
+        Shard& shard = ShardOf(key);
+        std::lock_guard<std::mutex> guard(shard.lock);
+
+        auto it = shard.where.find(key);
+
+        if (it != shard.where.end())
+        {
+            shard.slots[it->second].value.reset();
+            shard.slots[it->second].referenced = false;
+            shard.where.erase(it);
+        }
+    }
+
+    // Forget all the keys (the file was reorganized or reloaded)
+    void Clear()
+    {
+        for (auto& shard : m_Shards)
+        {
+            std::lock_guard<std::mutex> guard(shard->lock);
+
+            for (auto& slot : shard->slots)
+            {
+                slot.value.reset();
+                slot.referenced = false;
+            }
+
+            shard->where.clear();
+            shard->hand = 0;
+        }
+    }
+};
+
+// -------------------------------------------------------------
+// ----------------- Coroutine Classes -------------------------
+// -------------------------------------------------------------
+
+// Awaitable API of the Manager (FindAsync, AddAsync, ScanAsync), only when the compiler has
+// coroutines (C++20). The coroutines suspend on the page reads of a BlockFile and are resumed
+// by an Executor, so one thread can keep thousands of lookups in flight
+
+#if defined(__cpp_impl_coroutine)
+
+// Resumes the coroutines that are ready. An event loop takes part in the API by implementing Post
+class Executor
+{
+public:
+    virtual ~Executor() = default;
+
+    virtual void Post(std::coroutine_handle<> handle) = 0; // Resume (handle) later, on the thread of the executor
+};
+
+// Single thread event loop: resumes the posted coroutines and polls the completions of a file
+class LoopExecutor : public Executor
+{
+private:
+    std::deque<std::coroutine_handle<>> m_Ready;
+    BlockFile* m_File;
+public:
+    LoopExecutor(BlockFile* file = nullptr) : m_File(file) {}
+
+    void Post(std::coroutine_handle<> handle) override { m_Ready.push_back(handle); }
+
+    // Run until no coroutine is ready and no page read is in flight
+    void Run()
+    {
+        while (true)
+        {
+            while (!m_Ready.empty())
+            {
+                std::coroutine_handle<> handle = m_Ready.front();
+                m_Ready.pop_front();
+                handle.resume();
+            }
+
+            if (m_File == nullptr || m_File->getInFlight() == 0)
+                break;
+
+            m_File->Poll(true);
+        }
+    }
+};
+
+// Result of a coroutine. It starts when it is awaited (or with Start) and resumes its awaiter when it ends
+template <typename R>
+class Task
+{
+public:
+    struct promise_type
+    {
+        std::optional<R> result;
+        std::coroutine_handle<> awaiter;
+
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        auto final_suspend() noexcept
+        {
+            struct Resume
+            {
+                bool await_ready() noexcept { return false; }
+
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+                {
+                    std::coroutine_handle<> awaiter = handle.promise().awaiter;
+                    return awaiter ? awaiter : std::noop_coroutine();
+                }
+
+                void await_resume() noexcept {}
+            };
+
+            return Resume();
+        }
+
+        void return_value(R value) { result = std::move(value); }
+
+        void unhandled_exception() { std::terminate(); }
+    };
+private:
+    std::coroutine_handle<promise_type> m_Handle;
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : m_Handle(handle) {}
+public:
+    Task(Task&& other) noexcept : m_Handle(std::exchange(other.m_Handle, nullptr)) {}
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task()
+    {
+        if (m_Handle)
+            m_Handle.destroy();
+    }
+
+    // Run a task that nobody awaits until its first suspension (the loop runs the rest)
+    void Start() { m_Handle.resume(); }
+
+    bool IsDone() const { return m_Handle.done(); }
+
+    R& getResult() { return *m_Handle.promise().result; }
+
+    bool await_ready() const { return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter)
+    {
+        m_Handle.promise().awaiter = awaiter;
+        return m_Handle;
+    }
+
+    R await_resume() { return std::move(*m_Handle.promise().result); }
+};
+
+// Let the executor run other coroutines before going on
+struct Yield
+{
+    Executor& executor;
+
+    bool await_ready() const { return false; }
+
+    void await_suspend(std::coroutine_handle<> handle) { executor.Post(handle); }
+
+    void await_resume() const {}
+};
+
+// Read pages of a file at the same time, the coroutine resumes when all of them are read.
+// (page i) is read on buffer.getPage(i), the result is the number of pages read with errors
+struct PageReads
+{
+    BlockFile& file;
+    Executor& executor;
+    const std::vector<int>& pages;
+    PageBuffer& buffer;
+
+    int pending = 0;
+    int errors = 0;
+
+    bool await_ready() const { return pages.empty(); }
+
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        pending = (int)pages.size();
+
+        for (size_t i = 0; i < pages.size(); i++)
+        {
+            file.ReadAsync(pages[i], buffer.getPage(i), [this, handle](int result)
+            {
+                if (result != BLOCK_PAGE)
+                    errors++;
+
+                if (--pending == 0)
+                    executor.Post(handle);
+            });
+        }
+    }
+
+    int await_resume() const { return errors; }
+};
+
+#endif
+
+// -------------------------------------------------------------
+// ----------------- Write Buffer Classes ----------------------
+// -------------------------------------------------------------
+
+// Records added but not moved to the blocks yet (Manager::setWriteBuffer). They are kept sorted
+// by key, in order of arrival for equal keys, so a flush visits the blocks in order
+template <typename T>
+class WriteBuffer
+{
+public:
+    virtual ~WriteBuffer() = default;
+
+    virtual void Put(int key, T value) = 0;
+
+    virtual const Record<T>* Find(int key) const = 0; // First record of the key, or nullptr
+
+    virtual size_t getSize() const = 0;
+
+    // Move all the records to (records) in key order, the buffer is left empty
+    virtual void Drain(std::vector<Record<T>>& records) = 0;
+};
+
+// Write buffer for one thread, on a balanced tree
+template <typename T>
+class SortedBuffer : public WriteBuffer<T>
+{
+private:
+    std::multimap<int, Record<T>> m_Records;
+public:
+    void Put(int key, T value) override { m_Records.emplace(key, Record<T>(key, std::move(value))); } // After the records with the same key
+
+    const Record<T>* Find(int key) const override
+    {
+        auto it = m_Records.find(key);
+        return (it != m_Records.end()) ? &it->second : nullptr;
+    }
+
+    size_t getSize() const override { return m_Records.size(); }
+
+    void Drain(std::vector<Record<T>>& records) override
+    {
+        for (auto& pair : m_Records)
+            records.push_back(std::move(pair.second));
+
+        m_Records.clear();
+    }
+};
+
+#define SKIPLIST_LEVELS 12 // Enough for millions of records (each level has 1/4 of the nodes of the one below)
+
+// Write buffer that takes Put and Find from several threads at once, without locks: a skip list
+// where each node is linked with a compare and swap on each of its levels. Drain must not run
+// at the same time as the other calls
+template <typename T>
+class SkipListBuffer : public WriteBuffer<T>
+{
+private:
+    struct Node
+    {
+        Record<T> rec;
+        int levels;
+        std::atomic<Node*> next[SKIPLIST_LEVELS];
+
+        Node(int key, T value, int levels_) : rec(key, std::move(value)), levels(levels_)
+        {
+            for (auto& link : next)
+                link.store(nullptr, std::memory_order_relaxed);
+        }
+    };
+
+    Node m_Head;
+    std::atomic<size_t> m_Size;
+
+    static int RandomLevels()
+    {
+        thread_local std::mt19937 random(std::hash<std::thread::id>()(std::this_thread::get_id()));
+
+        int levels = 1;
+
+        while (levels < SKIPLIST_LEVELS && (random() & 3) == 0)
+            levels++;
+
+        return levels;
+    }
+
+    // Last node of each level before the position of (key): with (after), after the nodes of the
+    // same key (where a new one goes), else before them (where a search starts)
+    void Locate(int key, bool after, Node** preds, Node** succs) const
+    {
+        Node* pred = const_cast<Node*>(&m_Head);
+
+        for (int level = SKIPLIST_LEVELS - 1; level >= 0; level--)
+        {
+            Node* node = pred->next[level].load(std::memory_order_acquire);
+
+            while (node != nullptr && (node->rec.getKey() < key || (after && node->rec.getKey() == key)))
+            {
+                pred = node;
+                node = pred->next[level].load(std::memory_order_acquire);
+            }
+
+            preds[level] = pred;
+            succs[level] = node;
+        }
+    }
+public:
+    SkipListBuffer() : m_Head(0, T(), SKIPLIST_LEVELS), m_Size(0) {}
+
+    ~SkipListBuffer() override
+    {
+        std::vector<Record<T>> records;
+        Drain(records);
+    }
+
+    SkipListBuffer(const SkipListBuffer&) = delete;
+    SkipListBuffer& operator=(const SkipListBuffer&) = delete;
+
+    void Put(int key, T value) override
+    {
+        Node* node = new Node(key, std::move(value), RandomLevels());
+        Node* preds[SKIPLIST_LEVELS];
+        Node* succs[SKIPLIST_LEVELS];
+
+        Locate(key, true, preds, succs);
+
+        // The node is in the buffer once it is linked on the bottom level, the upper levels only
+        // make the searches faster
+        for (int level = 0; level < node->levels; level++)
+        {
+            while (true)
+            {
+                node->next[level].store(succs[level], std::memory_order_relaxed);
+
+                if (preds[level]->next[level].compare_exchange_strong(succs[level], node, std::memory_order_release, std::memory_order_relaxed))
+                    break;
+
+                Locate(key, true, preds, succs); // Another node was linked there meanwhile
+            }
+        }
+
+        m_Size.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    const Record<T>* Find(int key) const override
+    {
+        Node* preds[SKIPLIST_LEVELS];
+        Node* succs[SKIPLIST_LEVELS];
+
+        Locate(key, false, preds, succs);
+
+        return (succs[0] != nullptr && succs[0]->rec.getKey() == key) ? &succs[0]->rec : nullptr;
+    }
+
+    size_t getSize() const override { return m_Size.load(std::memory_order_relaxed); }
+
+    void Drain(std::vector<Record<T>>& records) override
+    {
+        Node* node = m_Head.next[0].load(std::memory_order_acquire);
+
+        while (node != nullptr)
+        {
+            Node* next = node->next[0].load(std::memory_order_relaxed);
+
+            records.push_back(std::move(node->rec));
+            delete node;
+
+            node = next;
+        }
+
+        for (auto& link : m_Head.next)
+            link.store(nullptr, std::memory_order_relaxed);
+
+        m_Size.store(0, std::memory_order_relaxed);
+    }
+};
+
+// -------------------------------------------------------------
+// ----------------- Manager Class --------------------------------
+// -------------------------------------------------------------
+
+template<typename T>
+class Manager
+{
+private:
+    IndexArea<T> m_IndexArea;
+    DataArea<T> m_DataArea;
+
+    // Operational metrics
+    StatCounters m_Counters;
+    LatencyHistogram m_AddLatency;
+    LatencyHistogram m_SearchLatency;
+
+    bool m_Verbose; // Print the result of each Add
+
+    std::unique_ptr<HotKeyCache<T>> m_Cache; // Values of the most read keys (nullptr if disabled)
+
+    std::atomic<uint64_t> m_Sequence; // Records added to the file, saved by Checkpoint (the position on the replication log)
+
+    std::unique_ptr<WriteBuffer<T>> m_Buffer; // Records not moved to the blocks yet (nullptr if disabled)
+    size_t m_BufferCapacity;
+    bool m_Concurrent; // Add and Find can run on several threads (skip list buffer)
+
+    int m_FileBlocks; // Blocks written by the last Checkpoint (or read by the last Load)
+    std::vector<std::atomic<int>> m_Reserved; // Records of the buffer of each block: count * 2, +1 if one goes after the end of the block
+
+    // With the write buffer: shared by the adds that buffer a record and by the finds, exclusive
+    // for the flushes and the adds that change the blocks
+    std::shared_mutex m_BufferLock;
+
+    // Last version of the index given to the snapshots
+    std::shared_ptr<const std::vector<std::pair<int, int>>> m_PublishedIndex;
+    uint64_t m_PublishedIndexVersion;
+    uint64_t m_Epoch; // Number of snapshots taken
+
+public:
+
+    Manager(int nBlocks, int cap, int capOverflow, HugePages hugePages = HugePages::TRANSPARENT) 
+        : m_DataArea(cap, nBlocks, capOverflow, hugePages), m_IndexArea(&m_DataArea), m_Verbose(true), m_Sequence(0), m_BufferCapacity(0), m_Concurrent(false), m_FileBlocks(0), m_PublishedIndexVersion(0), m_Epoch(0)
+        {
+            if (!m_DataArea.getBlocks().empty())
+            {
+                m_IndexArea.UpdateIndex(0, -1);
+            }
+        }
+
+    void setVerbose(bool verbose) { m_Verbose = verbose; } // Print (or not) the result of each Add
+
+    void setIndexMode(IndexMode mode) { m_IndexArea.setMode(mode); } // Search structure of the index (the entries are kept)
+
+    uint64_t getSequence() const { return m_Sequence; } // Number of records placed (including the ones of the loaded file, not the buffered ones)
+
+    // Keep the values of up to (entries) keys read by Find in a cache (0 disables it)
+    void setCache(size_t entries, int shards = 8)
+    {
+        m_Cache.reset(entries > 0 ? new HotKeyCache<T>(entries, shards) : nullptr);
+    }
+
+    // Keep up to (records) added records in a sorted write buffer, moved to the blocks in batches
+    // when it fills up (0 disables it). With (concurrent) the buffer is a skip list and Add and
+    // Find can be called from several threads at once (the cache is not used then); the other
+    // calls must not run at the same time as them
+    void setWriteBuffer(size_t records, bool concurrent = false)
+    {
+        Flush();
+
+        m_Buffer.reset(records == 0 ? nullptr : concurrent ? (WriteBuffer<T>*)new SkipListBuffer<T>() : new SortedBuffer<T>());
+        m_BufferCapacity = records;
+        m_Concurrent = (records > 0 && concurrent);
+        m_Reserved = std::vector<std::atomic<int>>(records == 0 ? 0 : m_DataArea.getMaxBlocks());
+
+        for (auto& reserved : m_Reserved)
+            reserved.store(0, std::memory_order_relaxed);
+    }
+
+    // Reserve room for a record of the write buffer in its block. A record is only buffered if the
+    // flush will merge it there as Add would place it: inside the block while it is not full, or
+    // after its end while it is not half full (else Add opens a new block or uses the overflow
+    // area, which can fail). So an Add that returned true is never rejected later.
+    // Called with m_BufferLock shared, the blocks don't change meanwhile
+    bool Reserve(int key)
+    {
+        int index = m_IndexArea.getIndexBlock(key);
+
+        if (index < 0 || index >= m_DataArea.getUsedBlocks())
+            return false;
+
+        auto& block = m_DataArea.getBlocks()[index];
+        auto& records = block.getRecords();
+
+        int half = (block.getCapacity() + 1) / 2;
+        bool afterEnd = records.empty() || key >= records.back().getKey();
+
+        int reserved = m_Reserved[index].load(std::memory_order_relaxed);
+
+        while (true)
+        {
+            int size = records.size() + reserved / 2;
+
+            // Once a record after the end is reserved, the block must stay under half full for it
+            bool fits = (afterEnd || (reserved & 1)) ? size < half : size < block.getCapacity();
+
+            if (!fits)
+                return false;
+
+            if (m_Reserved[index].compare_exchange_weak(reserved, (reserved + 2) | (afterEnd ? 1 : 0), std::memory_order_relaxed))
+                return true;
+        }
+    }
+
+    // Move the records of the write buffer to the blocks. They are taken in key order: the records
+    // that land inside a block are merged with it in one pass, the ones after its end too while the
+    // block is not half full (as in Add). Returns the number of records that didn't fit (0, the
+    // records were reserved when they were added)
+    int Flush()
+    {
+        if (m_Buffer == nullptr)
+            return 0;
+
+        std::unique_lock<std::shared_mutex> lock(m_BufferLock); // Waits for the adds and finds in progress
+
+        return FlushLocked();
+    }
+
+    int FlushLocked()
+    {
+        if (m_Buffer->getSize() == 0)
+            return 0;
+
+        std::vector<Record<T>> pending;
+        m_Buffer->Drain(pending);
+
+        for (auto& reserved : m_Reserved)
+            reserved.store(0, std::memory_order_relaxed);
+
+        m_Counters.Add(StatCounters::FLUSHES);
+
+        auto& blocks = m_DataArea.getBlocks();
+        int rejected = 0;
+        size_t i = 0;
+
+        while (i < pending.size())
+        {
+            int index = m_IndexArea.getIndexBlock(pending[i].getKey());
+            size_t end = i;
+
+            if (index >= 0 && index < m_DataArea.getUsedBlocks())
+            {
+                auto& records = blocks[index].getRecords();
+                int size = records.size();
+                int half = (blocks[index].getCapacity() + 1) / 2;
+                int lastKey = records.empty() ? INT_MIN : records.back().getKey();
+
+                // The records inside the block come first (key order), then the ones after its end,
+                // taken while the block (with the records taken before them) is not half full
+                while (end < pending.size() && m_IndexArea.getIndexBlock(pending[end].getKey()) == index
+                       && size + (int)(end - i) < blocks[index].getCapacity()
+                       && (pending[end].getKey() < lastKey || size + (int)(end - i) < half))
+                {
+                    end++;
+                }
+            }
+
+            if (end == i)
+            {
+                bool placed = Place(pending[i].getKey(), pending[i].getValue());
+                m_Sequence += placed;
+                rejected += !placed;
+                i++;
+                continue;
+            }
+
+            size_t merged = blocks[index].MergeRecords(pending.begin() + i, pending.begin() + end);
+            m_Sequence += merged;
+
+            if (merged > 0)
+                m_IndexArea.UpdateIndex(index, blocks[index].getRecords()[0].getKey());
+
+            i = end;
+        }
+
+        m_Counters.Add(StatCounters::FLUSH_REJECTED, rejected);
+        m_IndexArea.Prepare(); // The searches of the adds that run next only read the index
+
+        return rejected;
+    }
+
+    bool Add(int key, T value)
+    {
+        return Emplace(key, std::move(value));
+    }
+
+    // Add a record building its value in place from (args...), without intermediate copies
+    // (with the write buffer enabled, the record waits there until the next Flush)
+    template <typename... Args>
+    bool Emplace(int key, Args&&... args)
+    {
+        ScopedLatency latency(m_AddLatency);
+        m_Counters.Add(StatCounters::ADDS);
+
+        if (m_Cache != nullptr && !m_Concurrent)
+            m_Cache->Erase(key); // A cached value could be shadowed by the new record
+
+        if (m_Buffer != nullptr)
+        {
+            bool full;
+
+            {
+                std::shared_lock<std::shared_mutex> lock(m_BufferLock);
+
+                // Counted on the sequence when it is placed (Flush)
+                if (Reserve(key))
+                {
+                    m_Buffer->Put(key, T(std::forward<Args>(args)...));
+                    full = m_Buffer->getSize() >= m_BufferCapacity;
+                }
+                else
+                {
+                    full = false;
+                    lock.unlock();
+
+                    // It could be rejected: placed now, after the records buffered before it
+                    std::unique_lock<std::shared_mutex> exclusive(m_BufferLock);
+                    FlushLocked();
+
+                    bool placed = Place(key, std::forward<Args>(args)...);
+                    m_Sequence += placed;
+                    m_IndexArea.Prepare();
+
+                    return placed;
+                }
+            }
+
+            if (full)
+                Flush();
+
+            return true;
+        }
+
+        if (!Place(key, std::forward<Args>(args)...))
+            return false;
+
+        m_Sequence++;
+
+        return true;
+    }
+
+    // Add a record to its block (or to a new block, or to the overflow area)
+    template <typename... Args>
+    bool Place(int key, Args&&... args)
+    {
+        // Get the index of the block
+        int indexBlock = m_IndexArea.getIndexBlock(key);
+
+        // Add the record to the Data Area
+        std::string result = m_DataArea.AddRecordToData(indexBlock, key, std::forward<Args>(args)...);
+
+        if (result == "Overflow Block"
+            || (result.rfind("Block", 0) == 0)) // If the record was added successfully
+        {
+            if (m_Verbose)
+            {
+                LatencyPause pause; // The output is not part of the latency of the add
+                std::cout << "Key " << key << " added successfully in " << result << std::endl;
+            }
+            
+            // It only updates the index if it was inserted in a main block
+            if (result.rfind("Block", 0) == 0)
+            {
+                int pos = result.find(" "); // Find the position of the space after "Block"
+                int index = std::stoi(result.substr(pos + 1)); // Get the index of the block
+
+                auto& blocks = m_DataArea.getBlocks();
+                auto& block = blocks[index];
+
+                // Check if the block is not empty and update the index
+                if (!block.getRecords().empty())
+                {
+                    int newKey = block.getRecords()[0].getKey(); // Get the first key of the block to update the index
+                    m_IndexArea.UpdateIndex(index, newKey);
+                }
+            }
+
+            return true;
+        }
+
+        if (m_Verbose)
+        {
+            LatencyPause pause;
+            std::cout << "Error adding key " << key << " => (" << result << ")" << std::endl;
+        }
+
+        return false;
+    }
+
+    // Find the record of a key without printing it. (where) gets the block of the record,
+    // OVER if it is in the overflow area, BUFFERED if it is in the write buffer or -1 if the index
+    // points to an invalid block
+    const Record<T>* Lookup(int key, int& where)
+    {
+        ScopedLatency latency(m_SearchLatency);
+        m_Counters.Add(StatCounters::SEARCHES);
+
+        if (m_Buffer != nullptr)
+        {
+            const Record<T>* rec = m_Buffer->Find(key);
+
+            if (rec != nullptr)
+            {
+                m_Counters.Add(StatCounters::BUFFER_HITS);
+
+                where = BUFFERED;
+                return rec;
+            }
+        }
+
+        int probes = 0;
+        int indexBlock = m_IndexArea.getIndexBlock(key, &probes);
+        m_Counters.Add(StatCounters::INDEX_PROBES, probes);
+
+        int compared = 0;
+
+        where = -1;
+
+        if (indexBlock < 0 || indexBlock >= m_DataArea.getUsedBlocks())
+        {
+            return nullptr;
+        }
+
+        // Search in the main block
+        auto& block = m_DataArea.getBlocks()[indexBlock];
+        int pos = block.Find(key, &compared);
+
+        if (pos >= 0)
+        {
+            m_Counters.Add(StatCounters::RECORDS_COMPARED, compared);
+
+            where = indexBlock;
+            return &block.getRecords()[pos];
+        }
+
+        // If the record is not in the main block, search in the overflow area
+        auto& over = m_DataArea.getOverflow();
+        pos = over.Find(key, &compared);
+
+        if (pos >= 0)
+        {
+            m_Counters.Add(StatCounters::RECORDS_COMPARED, compared);
+            m_Counters.Add(StatCounters::OVERFLOW_HITS);
+
+            where = OVER;
+            return &over.getRecords()[pos];
+        }
+
+        // If the record is not in the overflow area either
+        m_Counters.Add(StatCounters::RECORDS_COMPARED, compared);
+        m_Counters.Add(StatCounters::OVERFLOW_MISSES);
+
+        where = indexBlock;
+        return nullptr;
+    }
+
+    // Copy the value of a key on (value), returns false if the key doesn't exist
+    bool Find(int key, T& value)
+    {
+        // With the write buffer, the buffered record can't be flushed (and freed) while it is copied
+        std::shared_lock<std::shared_mutex> lock(m_BufferLock, std::defer_lock);
+
+        if (m_Buffer != nullptr)
+            lock.lock();
+
+        if (m_Cache != nullptr && !m_Concurrent)
+        {
+            // Only a hit is timed here, a miss is timed (once) by Lookup
+            auto start = std::chrono::steady_clock::now();
+
+            if (m_Cache->Get(key, value))
+            {
+                m_SearchLatency.Record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+                m_Counters.Add(StatCounters::SEARCHES);
+                m_Counters.Add(StatCounters::CACHE_HITS);
+                return true;
+            }
+
+            m_Counters.Add(StatCounters::CACHE_MISSES);
+        }
+
+        int where;
+        const Record<T>* rec = Lookup(key, where);
+
+        if (rec == nullptr)
+        {
+            return false;
+        }
+
+        value = rec->getValue();
+
+        if (m_Cache != nullptr && !m_Concurrent)
+            m_Cache->Put(key, value);
+
+        return true;
+    }
+
+    // Visit the records with keys on [from, to] in key order
+    void Scan(int from, int to, const std::function<void(const Record<T>&)>& visit)
+    {
+        Flush(); // The buffered records are scanned from their blocks
+
+        auto& blocks = m_DataArea.getBlocks();
+        int used = m_DataArea.getUsedBlocks();
+        auto blockOf = [&](int n) { return (n >= 0 && n < used) ? &blocks[n] : nullptr; };
+
+        for (auto rec : CollectRange<T>(m_IndexArea.getKeyDir(), blockOf, m_DataArea.getOverflow(), from, to))
+        {
+            visit(*rec);
+        }
+    }
+
+    // Count and aggregates of the records with keys on [from, to]. The blocks that fall entirely
+    // on the range are answered from their zone maps, only the blocks at the edges of the range
+    // are read. (opened) returns the number of blocks read
+    ZoneMap RangeAggregate(int from, int to, int* opened = nullptr)
+    {
+        Flush();
+
+        ZoneMap result;
+
+        if (from > to)
+            return result;
+
+        auto add = [&](const Block<T>& block)
+        {
+            const ZoneMap& zone = block.getZone();
+
+            if (!zone.Overlaps(from, to))
+                return;
+
+            if (zone.Within(from, to))
+            {
+                result.Merge(zone);
+                return;
+            }
+
+            if (opened != nullptr)
+                (*opened)++;
+
+            auto& records = block.getRecords();
+            auto it = std::lower_bound(records.begin(), records.end(), from, [](const auto& rec, int k) { return rec.getKey() < k; });
+
+            for (; it != records.end() && it->getKey() <= to; ++it)
+                result.Add(*it);
+        };
+
+        auto& keyDir = m_IndexArea.getKeyDir();
+        auto& blocks = m_DataArea.getBlocks();
+
+        // The block of an index entry holds the keys up to the next entry, so the range starts
+        // on the last entry before (from)
+        auto it = std::lower_bound(keyDir.begin(), keyDir.end(), from, [](const auto& entry, int k) { return entry.first < k; });
+
+        if (it != keyDir.begin())
+            --it;
+
+        for (; it != keyDir.end() && it->first <= to; ++it)
+            add(blocks[it->second]);
+
+        add(m_DataArea.getOverflow());
+
+        return result;
+    }
+
+    // Number of records with keys on [from, to]
+    int RangeCount(int from, int to) { return RangeAggregate(from, to).count; }
+
+    // Number of chunks of a parallel scan: groups of (chunkBlocks) used blocks, and the overflow area
+    int getChunks(int chunkBlocks)
+    {
+        return (m_DataArea.getUsedBlocks() + chunkBlocks - 1) / chunkBlocks + 1;
+    }
+
+    // Visit the records of the chunk (the last chunk is the overflow area)
+    template <typename F>
+    void VisitChunk(int chunk, int chunkBlocks, F&& visit)
+    {
+        int used = m_DataArea.getUsedBlocks();
+        int first = chunk * chunkBlocks;
+
+        if (first >= used)
+        {
+            for (auto& rec : m_DataArea.getOverflow().getRecords())
+                visit(RecordView<T>(rec));
+
+            return;
+        }
+
+        auto& blocks = m_DataArea.getBlocks();
+
+        for (int i = first; i < std::min(used, first + chunkBlocks); i++)
+        {
+            for (auto& rec : blocks[i].getRecords())
+                visit(RecordView<T>(rec));
+        }
+    }
+
+    // Call (visit)(view) for every record on all the threads of the pool (no Add can run meanwhile).
+    // The order of the records is not defined and (visit) must be thread safe
+    void ForEach(const std::function<void(const RecordView<T>&)>& visit, WorkStealingPool& pool = WorkStealingPool::Default(), int chunkBlocks = 64)
+    {
+        Flush();
+
+        pool.ParallelFor(getChunks(chunkBlocks), [&](int chunk) { VisitChunk(chunk, chunkBlocks, visit); });
+    }
+
+    // Fold all the records in parallel: each chunk starts from (init) and folds its records with
+    // (accumulate)(acc, view), then the partial results are merged in chunk order with (combine)(acc, acc)
+    template <typename Acc, typename Accumulate, typename Combine>
+    Acc Reduce(Acc init, Accumulate accumulate, Combine combine, WorkStealingPool& pool = WorkStealingPool::Default(), int chunkBlocks = 64)
+    {
+        Flush();
+
+        int chunks = getChunks(chunkBlocks);
+        std::vector<Acc> partials(chunks, init);
+
+        pool.ParallelFor(chunks, [&](int chunk)
+        {
+            Acc& acc = partials[chunk];
+            VisitChunk(chunk, chunkBlocks, [&](const RecordView<T>& view) { acc = accumulate(std::move(acc), view); });
+        });
+
+        Acc result = std::move(init);
+
+        for (auto& partial : partials)
+        {
+            result = combine(std::move(result), std::move(partial));
+        }
+
+        return result;
+    }
+
+    // Write the records of the index entries [first, last) in key order, with the records of the
+    // overflow area that fall in their key range merged in between
+    void ExportRange(ExportWriter& writer, ExportFormat format, int first, int last)
+    {
+        auto& keyDir = m_IndexArea.getKeyDir();
+        auto& blocks = m_DataArea.getBlocks();
+        auto& over = m_DataArea.getOverflow().getRecords();
+
+        long long low = (first == 0) ? LLONG_MIN : keyDir[first].first;
+        long long high = (last >= (int)keyDir.size()) ? LLONG_MAX : keyDir[last].first;
+
+        // First record of the overflow area in the range
+        auto overIt = std::lower_bound(over.begin(), over.end(), low, [](const auto& rec, long long k) { return rec.getKey() < k; });
+
+        for (int i = first; i < last; i++)
+        {
+            for (auto& rec : blocks[keyDir[i].second].getRecords())
+            {
+                while (overIt != over.end() && overIt->getKey() < rec.getKey())
+                {
+                    writer.WriteRecord(format, *overIt++);
+                }
+
+                writer.WriteRecord(format, rec);
+            }
+        }
+
+        while (overIt != over.end() && overIt->getKey() < high)
+        {
+            writer.WriteRecord(format, *overIt++);
+        }
+    }
+
+    // Export all the records to a file in key order, the memory used is only the buffer
+    bool Export(const std::string& path, ExportFormat format, size_t bufferSize = 1 << 20)
+    {
+        Flush();
+
+        ExportWriter writer(bufferSize);
+
+        if (!writer.Open(path))
+        {
+            return false;
+        }
+
+        writer.WriteHeader(format);
+        ExportRange(writer, format, 0, m_IndexArea.getKeyDir().size());
+
+        return writer.Close();
+    }
+
+    // Export the records to one file per chunk of (chunkBlocks) blocks (prefix.0, prefix.1, ...),
+    // written in parallel. Concatenating the files in order gives the same file as Export.
+    // Returns the number of files, or -1 if one of them failed
+    int ExportChunks(const std::string& prefix, ExportFormat format, int chunkBlocks = 64, size_t bufferSize = 1 << 20,
+                     WorkStealingPool& pool = WorkStealingPool::Default())
+    {
+        Flush();
+
+        int entries = m_IndexArea.getKeyDir().size();
+        int chunks = std::max(1, (entries + chunkBlocks - 1) / chunkBlocks);
+        std::atomic<bool> failed(false);
+
+        pool.ParallelFor(chunks, [&](int chunk)
+        {
+            ExportWriter writer(bufferSize);
+
+            if (!writer.Open(prefix + "." + std::to_string(chunk)))
+            {
+                failed = true;
+                return;
+            }
+
+            if (chunk == 0)
+                writer.WriteHeader(format);
+
+            ExportRange(writer, format, chunk * chunkBlocks, std::min(entries, (chunk + 1) * chunkBlocks));
+
+            if (!writer.Close())
+                failed = true;
+        });
+
+        return failed ? -1 : chunks;
+    }
+
+    // Add a value read from an input file (text in CSV, raw bytes in binary)
+    bool AddParsed(int key, const char* bytes, size_t length, bool text)
+    {
+        if constexpr (std::is_arithmetic_v<T>)
+        {
+            T value = T();
+
+            if (text)
+                std::from_chars(bytes, bytes + length, value);
+            else
+                std::memcpy(&value, bytes, std::min(length, sizeof(T)));
+
+            return Emplace(key, value);
+        }
+        else if constexpr (std::is_trivially_copyable_v<T>)
+        {
+            T value;
+            std::memcpy(&value, bytes, std::min(length, sizeof(T)));
+
+            return Emplace(key, value);
+        }
+        else
+        {
+            // Built in place from the bytes of the mapping, no intermediate string
+            return Emplace(key, (const typename T::value_type*)bytes, length / sizeof(typename T::value_type));
+        }
+    }
+
+    // Import a file written by Export (CSV or binary). The file is mapped in memory, parsed in
+    // parallel chunks that are sorted on their own, and the sorted runs are merged and added in
+    // key order. Returns the number of records added, or -1 if the file can't be read
+    long long Import(const std::string& path, ExportFormat format, WorkStealingPool& pool = WorkStealingPool::Default())
+    {
+        MappedFile file;
+
+        if (!file.Open(path))
+        {
+            return -1;
+        }
+
+        const char* data = file.getData();
+        const char* end = data + file.getSize();
+
+        std::vector<ParsedRun> runs;
+
+        if (format == ExportFormat::CSV)
+        {
+            // Skip the header
+            if (file.getSize() >= 4 && std::memcmp(data, "key,", 4) == 0)
+            {
+                const char* lineEnd = (const char*)std::memchr(data, '\n', end - data);
+                data = (lineEnd != nullptr) ? lineEnd + 1 : end;
+            }
+
+            // Chunks of at least 1 MiB cut at the end of a line out of the quotes (a quoted value can
+            // hold new lines). A chunk starts out of the quotes, so the side of the cut is the parity
+            // of the quotes before it (an escaped "" counts twice)
+            const size_t chunkSize = std::max<size_t>(1 << 20, (end - data) / (pool.getThreads() * 4) + 1);
+            std::vector<std::pair<const char*, const char*>> chunks;
+
+            for (const char* p = data; p < end; )
+            {
+                const char* next = std::min(end, p + chunkSize);
+                bool quoted = (std::count(p, next, '"') % 2) != 0;
+
+                while (next < end && (quoted || *next != '\n'))
+                {
+                    quoted ^= (*next == '"');
+                    next++;
+                }
+
+                next = (next < end) ? next + 1 : end;
+
+                chunks.push_back({ p, next });
+                p = next;
+            }
+
+            runs.resize(chunks.size());
+            pool.ParallelFor(chunks.size(), [&](int i) { ParseCsvChunk(chunks[i].first, chunks[i].second, runs[i]); });
+        }
+        else
+        {
+            uint32_t magic = 0;
+
+            if (file.getSize() < sizeof(magic) || (std::memcpy(&magic, data, sizeof(magic)), magic != EXPORT_MAGIC))
+            {
+                return -1;
+            }
+
+            // The records have variable size: find them sequentially, then sort the runs in parallel
+            const size_t runRecords = 1 << 16;
+
+            for (const char* p = data + sizeof(magic); p + 3 * sizeof(int32_t) <= end; )
+            {
+                int32_t fields[3];
+                std::memcpy(fields, p, sizeof(fields));
+                p += sizeof(fields);
+
+                if (fields[2] < 0 || p + fields[2] > end)
+                    break;
+
+                if (runs.empty() || runs.back().records.size() >= runRecords)
+                    runs.emplace_back();
+
+                runs.back().records.push_back({ fields[0], p, (uint32_t)fields[2] });
+                p += fields[2];
+            }
+
+            pool.ParallelFor(runs.size(), [&](int i) { std::sort(runs[i].records.begin(), runs[i].records.end()); });
+        }
+
+        // Merge the sorted runs and add the records in key order
+        using Cursor = std::pair<ParsedRun*, size_t>;
+        auto greater = [](const Cursor& a, const Cursor& b) { return a.first->records[a.second].key > b.first->records[b.second].key; };
+        std::priority_queue<Cursor, std::vector<Cursor>, decltype(greater)> heads(greater);
+
+        for (auto& run : runs)
+        {
+            if (!run.records.empty())
+                heads.push({ &run, 0 });
+        }
+
+        bool verbose = m_Verbose;
+        long long added = 0;
+
+        m_Verbose = false;
+
+        while (!heads.empty())
+        {
+            Cursor head = heads.top();
+            heads.pop();
+
+            ParsedRecord& rec = head.first->records[head.second];
+
+            if (AddParsed(rec.key, rec.bytes, rec.length, format == ExportFormat::CSV))
+                added++;
+
+            if (++head.second < head.first->records.size())
+                heads.push(head);
+        }
+
+        m_Verbose = verbose;
+
+        return added;
+    }
+
+    void Search(int key)
+    {
+        int where;
+        const Record<T>* rec = Lookup(key, where);
+
+        if (rec == nullptr && where == -1)
+        {
+            std::cout << "Record with key " << key << " not found (invalid block)." << std::endl;
+        }
+        else if (rec == nullptr)
+        {
+            std::cout << "Record with key " << key << " not found." << std::endl;
+        }
+        else if (where == BUFFERED)
+        {
+            std::cout << "Record found in the Write Buffer: "
+                      << "key = " << rec->getKey() << ", value = " << rec->getValue() << std::endl;
+        }
+        else if (where == OVER)
+        {
+            std::cout << "Record found in the Overflow Area: "
+                      << "key = " << rec->getKey() << ", value = " << rec->getValue() 
+                      << ", dir = " << rec->getDirection() << std::endl;
+        }
+        else
+        {
+            std::cout << "Record found (Block " << where << "): "
+                      << "key = " << rec->getKey() << ", value = " << rec->getValue() 
+                      << ", dir = " << rec->getDirection() << std::endl;
+        }
+    }
+
+    // Take a consistent read-only view of the file. It can be read from any thread while this
+    // Manager keeps changing (it must be called from the thread that adds the records)
+    ReadSnapshot<T> Snapshot()
+    {
+        Flush();
+
+        std::vector<std::shared_ptr<const Block<T>>> blocks;
+        std::shared_ptr<const Block<T>> overflow;
+
+        m_DataArea.Publish(blocks, overflow);
+
+        if (!m_PublishedIndex || m_PublishedIndexVersion != m_IndexArea.getVersion())
+        {
+            m_PublishedIndex = std::make_shared<const std::vector<std::pair<int, int>>>(m_IndexArea.getKeyDir());
+            m_PublishedIndexVersion = m_IndexArea.getVersion();
+        }
+
+        return ReadSnapshot<T>(std::move(blocks), std::move(overflow), m_PublishedIndex, ++m_Epoch);
+    }
+
+    // Copy the blocks changed since the last call, and the index if it changed, on a shared area
+    // created with the geometry of this file, where the SharedReaders of other processes see them.
+    // Returns false if the records of a block don't fit on a page
+    bool Share(SharedArea& shared)
+    {
+        Flush();
+
+        auto& blocks = m_DataArea.getBlocks();
+
+        // The blocks first, so the readers that see the new index find their records
+        for (int i = 0; i < m_DataArea.getUsedBlocks(); i++)
+        {
+            if (!shared.WriteBlock(i, blocks[i]))
+                return false;
+        }
+
+        return shared.WriteBlock(OVERFLOW_PAGE, m_DataArea.getOverflow())
+            && shared.WriteIndex(m_IndexArea.getKeyDir(), m_IndexArea.getVersion(), m_DataArea.getUsedBlocks(), m_Sequence);
+    }
+
+    // Get the operational metrics of the file
+    ManagerStats Stats()
+    {
+        ManagerStats stats;
+
+        stats.adds = m_Counters.Get(StatCounters::ADDS);
+        stats.searches = m_Counters.Get(StatCounters::SEARCHES);
+        stats.indexProbes = m_Counters.Get(StatCounters::INDEX_PROBES);
+        stats.recordsCompared = m_Counters.Get(StatCounters::RECORDS_COMPARED);
+        stats.overflowHits = m_Counters.Get(StatCounters::OVERFLOW_HITS);
+        stats.overflowMisses = m_Counters.Get(StatCounters::OVERFLOW_MISSES);
+        stats.cacheHits = m_Counters.Get(StatCounters::CACHE_HITS);
+        stats.cacheMisses = m_Counters.Get(StatCounters::CACHE_MISSES);
+        stats.cacheCapacity = (m_Cache != nullptr) ? m_Cache->getCapacity() : 0;
+        stats.bufferHits = m_Counters.Get(StatCounters::BUFFER_HITS);
+        stats.flushes = m_Counters.Get(StatCounters::FLUSHES);
+        stats.flushRejected = m_Counters.Get(StatCounters::FLUSH_REJECTED);
+        stats.bufferSize = (m_Buffer != nullptr) ? m_Buffer->getSize() : 0;
+        stats.bufferCapacity = (m_Buffer != nullptr) ? m_BufferCapacity : 0;
+        stats.checksumErrors = m_Counters.Get(StatCounters::CHECKSUM_ERRORS);
+        stats.arenaBytes = m_DataArea.getArena().getMapped();
+        stats.arenaHugeBytes = m_DataArea.getArena().getHugeMapped();
+
+        stats.usedBlocks = m_DataArea.getUsedBlocks();
+        stats.maxBlocks = m_DataArea.getMaxBlocks();
+        stats.indexEntries = m_IndexArea.getKeyDir().size();
+        stats.overflowSize = m_DataArea.getOverflow().getRecords().size();
+        stats.overflowCapacity = m_DataArea.getOverflow().getCapacity();
+
+        stats.addP50 = m_AddLatency.Percentile(50);
+        stats.addP99 = m_AddLatency.Percentile(99);
+        stats.addP999 = m_AddLatency.Percentile(99.9);
+        stats.searchP50 = m_SearchLatency.Percentile(50);
+        stats.searchP99 = m_SearchLatency.Percentile(99);
+        stats.searchP999 = m_SearchLatency.Percentile(99.9);
+
+        return stats;
+    }
+
+    void ShowStats()
+    {
+        ManagerStats stats = Stats();
+
+        std::cout << "\n--- Stats ---" << std::endl;
+        std::cout << "Adds: " << stats.adds << " => p50/p99/p99.9 (ns): " << stats.addP50 << "/" << stats.addP99 << "/" << stats.addP999 << std::endl;
+        std::cout << "Searches: " << stats.searches << " => p50/p99/p99.9 (ns): " << stats.searchP50 << "/" << stats.searchP99 << "/" << stats.searchP999 << std::endl;
+        std::cout << "Index probes: " << stats.indexProbes << " => Records compared per search: " << stats.RecordsPerSearch() << std::endl;
+        std::cout << "Overflow hits/misses: " << stats.overflowHits << "/" << stats.overflowMisses << " => Hit rate: " << stats.OverflowHitRate() << std::endl;
+        std::cout << "Blocks: " << stats.usedBlocks << "/" << stats.maxBlocks << " => Overflow: " << stats.overflowSize << "/" << stats.overflowCapacity << std::endl;
+        std::cout << "Arena: " << stats.arenaBytes << " bytes mapped => On huge pages: " << stats.arenaHugeBytes << std::endl;
+
+        if (stats.cacheCapacity > 0)
+            std::cout << "Cache hits/misses: " << stats.cacheHits << "/" << stats.cacheMisses << " => Hit rate: " << stats.CacheHitRate() << " (" << stats.cacheCapacity << " entries)" << std::endl;
+
+        if (stats.bufferCapacity > 0)
+            std::cout << "Write buffer: " << stats.bufferSize << "/" << stats.bufferCapacity << " => Hits: " << stats.bufferHits
+                      << " => Flushes: " << stats.flushes << " (" << stats.flushRejected << " records rejected)" << std::endl;
+
+        if (stats.checksumErrors > 0)
+            std::cout << "Checksum errors: " << stats.checksumErrors << " pages" << std::endl;
+    }
+
+    // Save the Data Area on a file
+    // (direct) writes the pages without going through the page cache (O_DIRECT)
+    bool Checkpoint(const std::string& path, bool direct = false)
+    {
+        Flush();
+
+        BlockFile file;
+
+        if (!file.Open(path, true, 64, direct) || !m_DataArea.Checkpoint(file, m_Sequence))
+            return false;
+
+        m_FileBlocks = m_DataArea.getUsedBlocks();
+
+        return true;
+    }
+
+    // Check a page of (block) (OVERFLOW_PAGE for the overflow area) read from the file of the last
+    // Checkpoint or Load. The pages of the blocks added after it were never written and read as
+    // zeros (no records); any other page must be a valid page of its block, else it counts as a
+    // checksum error
+    bool CheckFilePage(const char* page, int block)
+    {
+        PageHeader header;
+        std::memcpy(&header, page, sizeof(header));
+
+        bool written = (block == OVERFLOW_PAGE || block < m_FileBlocks);
+
+        if (!written && header.magic != PAGE_MAGIC)
+            return false;
+
+        if (header.block == block && CheckPage(page))
+            return true;
+
+        m_Counters.Add(StatCounters::CHECKSUM_ERRORS);
+
+        return false;
+    }
+
+    // Load the Data Area from a file written by Checkpoint and rebuild the index
+    bool Load(const std::string& path, bool direct = false)
+    {
+        BlockFile file;
+
+        uint64_t sequence = 0;
+
+        if (!file.Open(path, false, 64, direct) || !m_DataArea.Load(file, &sequence))
+        {
+            return false;
+        }
+
+        m_Sequence = sequence;
+        m_FileBlocks = m_DataArea.getUsedBlocks();
+
+        if (m_Cache != nullptr)
+            m_Cache->Clear();
+
+        auto& blocks = m_DataArea.getBlocks();
+
+        for (int i = 0; i < m_DataArea.getUsedBlocks(); i++)
+        {
+            if (!blocks[i].getRecords().empty())
+            {
+                m_IndexArea.UpdateIndex(i, blocks[i].getRecords()[0].getKey());
+            }
+        }
+
+        return true;
+    }
+
+    // Search a batch of keys on the pages of a file written by Checkpoint (cold lookups).
+    // Many page reads are kept in flight at once from this thread; (found)(key, value) gets
+    // nullptr as value if the key is not on the file
+    void SearchFile(BlockFile& file, const std::vector<int>& keys, const std::function<void(int, const T*)>& found)
+    {
+        struct Lookup
+        {
+            int key;
+            int block; // Block of the page read
+            bool overflow; // The main block was already read
+        };
+
+        const int window = 64; // Lookups in flight
+
+        PageBuffer pages(window);
+        std::vector<Lookup> lookups(window);
+        std::vector<int> freeSlots;
+
+        for (int i = window - 1; i >= 0; i--)
+        {
+            freeSlots.push_back(i);
+        }
+
+        size_t next = 0;
+
+        std::function<void(int)> start;
+        std::function<void(int, int)> complete;
+
+        // Report the value of the key if it is on the page of the slot
+        auto findOnPage = [&](int slot)
+        {
+            bool hit = false;
+
+            if (!CheckFilePage(pages.getPage(slot), lookups[slot].block))
+                return false;
+
+            VisitPage(pages.getPage(slot), [&](int key, int, const char* bytes, size_t length)
+            {
+                if (key != lookups[slot].key)
+                    return true;
+
+                T value = DecodeValue<T>(bytes, length, std::pmr::polymorphic_allocator<std::byte>());
+                found(key, &value);
+                hit = true;
+
+                return false;
+            });
+
+            return hit;
+        };
+
+        complete = [&](int slot, int result)
+        {
+            if (result == BLOCK_PAGE && findOnPage(slot))
+            {
+                start(slot);
+            }
+            else if (!lookups[slot].overflow)
+            {
+                // Try the overflow area
+                lookups[slot].overflow = true;
+                lookups[slot].block = OVERFLOW_PAGE;
+                file.ReadAsync(m_DataArea.getOverflowPage(), pages.getPage(slot), [&, slot](int res) { complete(slot, res); });
+            }
+            else
+            {
+                found(lookups[slot].key, nullptr);
+                start(slot);
+            }
+        };
+
+        // Start the next lookup on a free slot
+        start = [&](int slot)
+        {
+            if (next >= keys.size())
+            {
+                return;
+            }
+
+            int key = keys[next++];
+            int indexBlock = m_IndexArea.getIndexBlock(key);
+
+            lookups[slot] = { key, indexBlock, false };
+            file.ReadAsync(m_DataArea.getPageOf(indexBlock), pages.getPage(slot), [&, slot](int res) { complete(slot, res); });
+        };
+
+        for (int slot : freeSlots)
+        {
+            start(slot);
+        }
+
+        file.Drain();
+    }
+
+#if defined(__cpp_impl_coroutine)
+    // Search a key on the pages of a file written by Checkpoint without blocking the thread: the
+    // coroutine suspends on each page read and (executor) resumes it when the read completes
+    Task<std::optional<T>> FindAsync(BlockFile& file, int key, Executor& executor)
+    {
+        int indexBlock = std::max(0, m_IndexArea.getIndexBlock(key));
+        std::vector<int> pages = { m_DataArea.getPageOf(indexBlock) };
+        PageBuffer buffer;
+        std::optional<T> value;
+
+        auto findOnPage = [&](int block)
+        {
+            if (!CheckFilePage(buffer.getPage(), block))
+                return;
+
+            VisitPage(buffer.getPage(), [&](int k, int, const char* bytes, size_t length)
+            {
+                if (k != key)
+                    return true;
+
+                value = DecodeValue<T>(bytes, length, std::pmr::polymorphic_allocator<std::byte>());
+                return false;
+            });
+        };
+
+        if (co_await PageReads{ file, executor, pages, buffer } == 0)
+            findOnPage(indexBlock);
+
+        if (!value)
+        {
+            // Try the overflow area
+            pages[0] = m_DataArea.getOverflowPage();
+
+            if (co_await PageReads{ file, executor, pages, buffer } == 0)
+                findOnPage(OVERFLOW_PAGE);
+        }
+
+        co_return value;
+    }
+
+    // Add a record as a step of the executor, after the coroutines that are ready
+    // (the records are added in memory, there is no page to wait for)
+    Task<bool> AddAsync(int key, T value, Executor& executor)
+    {
+        co_await Yield{ executor };
+        co_return Add(key, std::move(value));
+    }
+
+    // Read the records with keys on [from, to] from a file written by Checkpoint, in key order.
+    // The pages of all the blocks of the range are read at the same time
+    Task<std::vector<std::pair<int, T>>> ScanAsync(BlockFile& file, int from, int to, Executor& executor)
+    {
+        auto& keyDir = m_IndexArea.getKeyDir();
+        std::vector<int> pages;
+        std::vector<int> blocks;
+
+        // The block of an index entry holds the keys up to the next entry
+        auto it = std::lower_bound(keyDir.begin(), keyDir.end(), from, [](const auto& entry, int k) { return entry.first < k; });
+
+        if (it != keyDir.begin())
+            --it;
+
+        for (; from <= to && it != keyDir.end() && it->first <= to; ++it)
+        {
+            pages.push_back(m_DataArea.getPageOf(it->second));
+            blocks.push_back(it->second);
+        }
+
+        pages.push_back(m_DataArea.getOverflowPage());
+        blocks.push_back(OVERFLOW_PAGE);
+
+        PageBuffer buffer(pages.size());
+        co_await PageReads{ file, executor, pages, buffer };
+
+        std::vector<std::pair<int, T>> found;
+
+        // The pages that were not written yet have no records, the bad ones count as checksum errors
+        for (size_t i = 0; i < pages.size(); i++)
+        {
+            if (!CheckFilePage(buffer.getPage(i), blocks[i]))
+                continue;
+
+            VisitPage(buffer.getPage(i), [&](int key, int, const char* bytes, size_t length)
+            {
+                if (key >= from && key <= to)
+                    found.emplace_back(key, DecodeValue<T>(bytes, length, std::pmr::polymorphic_allocator<std::byte>()));
+
+                return true;
+            });
+        }
+
+        std::stable_sort(found.begin(), found.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+        co_return found;
+    }
+#endif
+
+    void Show()
+    {
+        std::cout << "\n--- Index Area ---\n";
+
+        for (auto& pair : m_IndexArea.getKeyDir())
+        {
+            std::cout << "Key: " << pair.first << " => Dir: " << (pair.second * N) << "\n";
+        }
+
+        ShowDataArea();
+    }
+
+    void ShowDataArea()
+    {
+        std::cout << "\n--- Data Area ---\n";
+
+        int i = 0;
+
+        // Show all the blocks in the Main Area
+
+        for (auto& block : m_DataArea.getBlocks())
+        {
+            std::cout << "Block: " << i++ << "\n";
+
+            for (auto& rec : block.getRecords())
+            {
+                std::cout << "\t~ Key: " << rec.getKey() << " => Value: " << rec.getValue() << " => Direction: " << rec.getDirection() << "\n";
+            }
+        }
+
+        // Show the Overflow Area
+
+        std::cout << "\n\t[Overflow Area]\n";
+
+        auto& m_Over = m_DataArea.getOverflow();
+        for (auto& rec : m_Over.getRecords())
+        {
+            std::cout << "\t~ Key: " << rec.getKey() << " => Value: " << rec.getValue() << " => Direction: " << rec.getDirection() << "\n";
+        }
+
+        std::cout.flush(); // Flush once, not after each line
+    }
+};
+
+// -------------------------------------------------------------
+// ----------------- Replication Classes -----------------------
+// -------------------------------------------------------------
+
+// The primary sends the records it adds to its followers in batches over a stream (a pipe, a
+// Unix socket or a socketpair). Layout of a batch: [LogBatch][key, length, value bytes]...
+// A follower starts by sending the sequence of the checkpoint it loaded (the primary resends the
+// records added after it) and then answers each batch with the sequence it has applied
+
+#define LOG_MAGIC 0x49445852 // "IDXR"
+#define LOG_BATCH 256 // Records per batch
+#define LOG_MAX_LAG 8192 // Records a follower can be behind before the primary waits for it
+
+struct LogBatch
+{
+    uint32_t magic;
+    uint32_t count; // Number of records
+    uint32_t bytes; // Bytes of the records after the header
+    uint32_t reserved;
+    uint64_t first; // Sequence of the first record (the number of records added before it)
+};
+
+// Message of a follower: the sequence it has applied
+struct LogAck
+{
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t sequence;
+};
+
+// Write all the bytes on a stream, returns false if it fails or the other end is closed
+inline bool WriteAll(int fd, const void* data, size_t length)
+{
+    const char* bytes = (const char*)data;
+
+    while (length > 0)
+    {
+        ssize_t result = write(fd, bytes, length);
+
+        if (result < 0 && errno == EINTR)
+            continue;
+
+        if (result <= 0)
+            return false;
+
+        bytes += result;
+        length -= result;
+    }
+
+    return true;
+}
+
+// Read exactly (length) bytes from a stream, returns false if it fails or the other end is closed
+inline bool ReadAll(int fd, void* data, size_t length)
+{
+    char* bytes = (char*)data;
+
+    while (length > 0)
+    {
+        ssize_t result = read(fd, bytes, length);
+
+        if (result < 0 && errno == EINTR)
+            continue;
+
+        if (result <= 0)
+            return false;
+
+        bytes += result;
+        length -= result;
+    }
+
+    return true;
+}
+
+// Adds the records to a Manager and ships them to the followers. All the records must be added
+// through it. The records added since the last Checkpoint are kept for the followers that
+// start from that checkpoint
+template <typename T>
+class ReplicationPrimary
+{
+private:
+    struct Follower
+    {
+        int fd;
+        uint64_t acked; // Sequence applied by the follower
+        bool failed; // The stream was closed or broken, the follower is left behind
+    };
+
+    Manager<T>& m_Manager;
+    std::vector<Follower> m_Followers;
+
+    std::vector<char> m_Log; // Records added since the last checkpoint, encoded as in the batches
+    uint64_t m_LogFirst; // Sequence of the first record of the log
+    size_t m_Shipped; // Bytes of the log already sent, the rest is the open batch
+    uint64_t m_ShippedSequence; // Sequence after the last record sent
+
+    int m_MaxLag;
+    uint64_t m_Batches;
+    uint64_t m_LagPeak; // Largest lag seen when a batch was shipped
+
+    // Offset of the log after (count) records from (offset)
+    size_t SkipRecords(size_t offset, uint64_t count) const
+    {
+        for (uint64_t i = 0; i < count; i++)
+        {
+            int32_t fields[2];
+            std::memcpy(fields, m_Log.data() + offset, sizeof(fields));
+            offset += sizeof(fields) + fields[1];
+        }
+
+        return offset;
+    }
+
+    bool SendBatch(Follower& follower, uint64_t first, uint32_t count, size_t from, size_t to)
+    {
+        LogBatch batch = { LOG_MAGIC, count, (uint32_t)(to - from), 0, first };
+
+        if (!WriteAll(follower.fd, &batch, sizeof(batch)) || !WriteAll(follower.fd, m_Log.data() + from, to - from))
+            follower.failed = true;
+
+        return !follower.failed;
+    }
+
+    // Read the acknowledgments that arrived, (wait) blocks until the follower answers
+    void ReadAck(Follower& follower, bool wait)
+    {
+        pollfd pfd = { follower.fd, POLLIN, 0 };
+
+        while (!follower.failed && (wait || poll(&pfd, 1, 0) > 0))
+        {
+            LogAck ack;
+
+            if (!ReadAll(follower.fd, &ack, sizeof(ack)) || ack.magic != LOG_MAGIC)
+            {
+                follower.failed = true;
+                break;
+            }
+
+            follower.acked = ack.sequence;
+            wait = false;
+        }
+    }
+public:
+    ReplicationPrimary(Manager<T>& manager, int maxLag = LOG_MAX_LAG)
+        : m_Manager(manager), m_LogFirst(manager.getSequence()), m_Shipped(0), m_ShippedSequence(manager.getSequence()),
+          m_MaxLag(maxLag), m_Batches(0), m_LagPeak(0) {}
+
+    // Add a follower connected on (fd). It sends first the sequence it starts from, which must
+    // be on the kept log (0 for an empty follower if no checkpoint was taken yet)
+    bool Attach(int fd)
+    {
+        Flush();
+
+        Follower follower = { fd, 0, false };
+        LogAck hello;
+
+        if (!ReadAll(fd, &hello, sizeof(hello)) || hello.magic != LOG_MAGIC
+            || hello.sequence < m_LogFirst || hello.sequence > m_ShippedSequence)
+        {
+            return false;
+        }
+
+        follower.acked = hello.sequence;
+
+        // Catch up from its checkpoint
+        uint64_t sequence = hello.sequence;
+        size_t offset = SkipRecords(0, sequence - m_LogFirst);
+
+        while (sequence < m_ShippedSequence)
+        {
+            uint32_t count = (uint32_t)std::min<uint64_t>(LOG_BATCH, m_ShippedSequence - sequence);
+            size_t end = SkipRecords(offset, count);
+
+            if (!SendBatch(follower, sequence, count, offset, end))
+                return false;
+
+            sequence += count;
+            offset = end;
+
+            // Don't let the catch-up get too far ahead of the follower
+            while (sequence - follower.acked > (uint64_t)m_MaxLag && !follower.failed)
+                ReadAck(follower, true);
+        }
+
+        m_Followers.push_back(follower);
+
+        return !follower.failed;
+    }
+
+    bool Add(int key, const T& value)
+    {
+        size_t length;
+        const char* bytes = ValueBytes(value, length);
+
+        int32_t fields[2] = { key, (int32_t)length };
+        size_t size = m_Log.size();
+
+        m_Log.insert(m_Log.end(), (const char*)fields, (const char*)fields + sizeof(fields));
+        m_Log.insert(m_Log.end(), bytes, bytes + length);
+
+        if (!m_Manager.Add(key, value))
+        {
+            m_Log.resize(size); // Nothing changed, nothing to ship
+            return false;
+        }
+
+        if (m_Manager.getSequence() - m_ShippedSequence >= LOG_BATCH)
+            Flush();
+
+        return true;
+    }
+
+    // Ship the open batch, then wait while a follower is more than the maximum lag behind
+    void Flush()
+    {
+        m_Manager.Flush(); // The buffered records are on the log but not on the sequence yet
+
+        uint64_t sequence = m_Manager.getSequence();
+
+        if (sequence > m_ShippedSequence)
+        {
+            for (auto& follower : m_Followers)
+            {
+                if (!follower.failed)
+                    SendBatch(follower, m_ShippedSequence, (uint32_t)(sequence - m_ShippedSequence), m_Shipped, m_Log.size());
+            }
+
+            m_Shipped = m_Log.size();
+            m_ShippedSequence = sequence;
+            m_Batches++;
+        }
+
+        for (auto& follower : m_Followers)
+        {
+            ReadAck(follower, false);
+            m_LagPeak = std::max(m_LagPeak, follower.failed ? 0 : sequence - follower.acked);
+
+            while (!follower.failed && sequence - follower.acked > (uint64_t)m_MaxLag)
+                ReadAck(follower, true);
+        }
+    }
+
+    // Wait until every follower has applied all the records shipped
+    void Sync()
+    {
+        Flush();
+
+        for (auto& follower : m_Followers)
+        {
+            while (!follower.failed && follower.acked < m_ShippedSequence)
+                ReadAck(follower, true);
+        }
+    }
+
+    // Save the file and drop the log before it: new followers start from this checkpoint
+    bool Checkpoint(const std::string& path, bool direct = false)
+    {
+        Flush();
+
+        if (!m_Manager.Checkpoint(path, direct))
+            return false;
+
+        m_Log.clear();
+        m_LogFirst = m_Manager.getSequence();
+        m_Shipped = 0;
+
+        return true;
+    }
+
+    // Records the slowest follower is behind (as of its last acknowledgment)
+    uint64_t getLag() const
+    {
+        uint64_t lag = 0;
+
+        for (auto& follower : m_Followers)
+        {
+            if (!follower.failed)
+                lag = std::max(lag, m_Manager.getSequence() - follower.acked);
+        }
+
+        return lag;
+    }
+
+    uint64_t getLagPeak() const { return m_LagPeak; }
+
+    uint64_t getBatches() const { return m_Batches; }
+
+    size_t getLogBytes() const { return m_Log.size(); }
+
+    int getFollowers() const { return std::count_if(m_Followers.begin(), m_Followers.end(), [](auto& f) { return !f.failed; }); }
+};
+
+// Applies the records shipped by a primary to its own Manager and serves reads from the
+// last batch applied. The reads can run on any thread while Run applies the batches
+template <typename T>
+class ReplicationFollower
+{
+private:
+    Manager<T> m_Manager;
+    int m_Fd;
+
+    std::vector<char> m_Buffer;
+
+    std::mutex m_Mutex; // Guards m_Snapshot
+    std::shared_ptr<const ReadSnapshot<T>> m_Snapshot;
+    std::atomic<uint64_t> m_Applied;
+
+    void Publish()
+    {
+        auto snapshot = std::make_shared<const ReadSnapshot<T>>(m_Manager.Snapshot());
+
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Snapshot = std::move(snapshot);
+        m_Applied = m_Manager.getSequence();
+    }
+
+    bool SendAck()
+    {
+        LogAck ack = { LOG_MAGIC, 0, m_Manager.getSequence() };
+        return WriteAll(m_Fd, &ack, sizeof(ack));
+    }
+public:
+    ReplicationFollower(int nBlocks, int cap, int capOverflow) : m_Manager(nBlocks, cap, capOverflow), m_Fd(-1), m_Applied(0)
+    {
+        m_Manager.setVerbose(false);
+        Publish();
+    }
+
+    // Load the checkpoint of the primary (if any) and ask the primary for the records after it
+    bool Attach(int fd, const std::string& checkpoint = "", bool direct = false)
+    {
+        if (!checkpoint.empty() && !m_Manager.Load(checkpoint, direct))
+            return false;
+
+        m_Fd = fd;
+        Publish();
+
+        return SendAck();
+    }
+
+    // Apply the next batch, returns false when the stream is closed or the batch can't be applied
+    bool ApplyBatch()
+    {
+        LogBatch batch;
+
+        if (!ReadAll(m_Fd, &batch, sizeof(batch)) || batch.magic != LOG_MAGIC || batch.first != m_Manager.getSequence())
+            return false;
+
+        m_Buffer.resize(batch.bytes);
+
+        if (!ReadAll(m_Fd, m_Buffer.data(), batch.bytes))
+            return false;
+
+        size_t offset = 0;
+
+        for (uint32_t i = 0; i < batch.count; i++)
+        {
+            int32_t fields[2];
+
+            if (offset + sizeof(fields) > batch.bytes)
+                return false;
+
+            std::memcpy(fields, m_Buffer.data() + offset, sizeof(fields));
+            offset += sizeof(fields);
+
+            if (fields[1] < 0 || offset + fields[1] > batch.bytes || !m_Manager.AddParsed(fields[0], m_Buffer.data() + offset, fields[1], false))
+                return false; // The follower doesn't match the primary anymore
+
+            offset += fields[1];
+        }
+
+        Publish();
+
+        return SendAck();
+    }
+
+    // Apply the batches until the primary closes the stream
+    void Run()
+    {
+        while (ApplyBatch())
+        {
+        }
+    }
+
+    // Last applied state, a read-only view that stays valid while more batches are applied
+    std::shared_ptr<const ReadSnapshot<T>> Snapshot()
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return m_Snapshot;
+    }
+
+    bool Find(int key, T& value) { return Snapshot()->Find(key, value); }
+
+    void Scan(int from, int to, const std::function<void(const Record<T>&)>& visit) { Snapshot()->Scan(from, to, visit); }
+
+    uint64_t getSequence() const { return m_Applied; } // Records applied (and readable)
+};
+
+// -------------------------------------------------------------
+// ----------------- ShardedManager Class ----------------------
+// -------------------------------------------------------------
+
+// Splits the key space in ranges, each range (shard) has its own Manager (index, data and
+// overflow areas) served by its own worker thread, so the writers never share a structure
+template <typename T>
+class ShardedManager
+{
+private:
+    struct Shard
+    {
+        Manager<T> manager;
+
+        std::thread worker;
+        std::mutex mutex;
+        std::condition_variable ready;
+        std::deque<std::function<void()>> tasks;
+        bool stop;
+
+        Shard(int nBlocks, int cap, int capOverflow) : manager(nBlocks, cap, capOverflow), stop(false) {}
+    };
+
+    std::vector<int> m_Bounds; // First key of each shard (except the first one)
+    std::vector<std::unique_ptr<Shard>> m_Shards;
+
+    static void Run(Shard* shard)
+    {
+        while (true)
+        {
+            std::function<void()> task;
+
+            {
+                std::unique_lock<std::mutex> lock(shard->mutex);
+                shard->ready.wait(lock, [shard] { return shard->stop || !shard->tasks.empty(); });
+
+                if (shard->tasks.empty())
+                    return;
+
+                task = std::move(shard->tasks.front());
+                shard->tasks.pop_front();
+            }
+
+            task();
+        }
+    }
+
+    // Run (task)(manager) on the worker of the shard, the result is returned through a future
+    template <typename F>
+    auto Post(int shard, F task) -> std::future<decltype(task(std::declval<Manager<T>&>()))>
+    {
+        using Result = decltype(task(std::declval<Manager<T>&>()));
+
+        Shard* s = m_Shards[shard].get();
+        auto job = std::make_shared<std::packaged_task<Result()>>([s, task = std::move(task)]() mutable { return task(s->manager); });
+        auto result = job->get_future();
+
+        {
+            std::lock_guard<std::mutex> lock(s->mutex);
+            s->tasks.emplace_back([job] { (*job)(); });
+        }
+
+        s->ready.notify_one();
+
+        return result;
+    }
+public:
+    // (bounds) are the first keys of the shards 1..n (sorted), each shard gets the given geometry.
+    // If (pin) the worker of the shard i runs only on the core i % cores
+    ShardedManager(std::vector<int> bounds, int nBlocks, int cap, int capOverflow, bool pin = true) : m_Bounds(std::move(bounds))
+    {
+        std::sort(m_Bounds.begin(), m_Bounds.end());
+
+        int cores = std::max(1u, std::thread::hardware_concurrency());
+
+        for (size_t i = 0; i <= m_Bounds.size(); i++)
+        {
+            m_Shards.push_back(std::make_unique<Shard>(nBlocks, cap, capOverflow));
+
+            Shard* shard = m_Shards.back().get();
+            shard->manager.setVerbose(false);
+            shard->worker = std::thread(Run, shard);
+
+            if (pin)
+            {
+                cpu_set_t cpus;
+                CPU_ZERO(&cpus);
+                CPU_SET(i % cores, &cpus);
+                pthread_setaffinity_np(shard->worker.native_handle(), sizeof(cpus), &cpus);
+            }
+        }
+    }
+
+    ~ShardedManager()
+    {
+        for (auto& shard : m_Shards)
+        {
+            {
+                std::lock_guard<std::mutex> lock(shard->mutex);
+                shard->stop = true;
+            }
+
+            shard->ready.notify_one();
+            shard->worker.join();
+        }
+    }
+
+    ShardedManager(const ShardedManager&) = delete;
+    ShardedManager& operator=(const ShardedManager&) = delete;
+
+    int getShards() const { return (int)m_Shards.size(); }
+
+    int ShardOf(int key) const { return std::upper_bound(m_Bounds.begin(), m_Bounds.end(), key) - m_Bounds.begin(); }
+
+    std::future<bool> Add(int key, T value)
+    {
+        return Post(ShardOf(key), [key, value = std::move(value)](Manager<T>& manager) mutable { return manager.Add(key, std::move(value)); });
+    }
+
+    std::future<std::optional<T>> Find(int key)
+    {
+        return Post(ShardOf(key), [key](Manager<T>& manager)
+        {
+            T value;
+            return manager.Find(key, value) ? std::optional<T>(std::move(value)) : std::nullopt;
+        });
+    }
+
+    // Visit the records with keys on [from, to] in key order, the shards are scanned in parallel
+    void Scan(int from, int to, const std::function<void(int, const T&)>& visit)
+    {
+        std::vector<std::future<std::vector<std::pair<int, T>>>> parts;
+
+        for (int i = ShardOf(from); i <= ShardOf(to); i++)
+        {
+            parts.push_back(Post(i, [from, to](Manager<T>& manager)
+            {
+                std::vector<std::pair<int, T>> records;
+                manager.Scan(from, to, [&records](const Record<T>& rec) { records.emplace_back(rec.getKey(), rec.getValue()); });
+                return records;
+            }));
+        }
+
+        // The shards are ranges of keys, so their results are already in order
+        for (auto& part : parts)
+        {
+            for (auto& rec : part.get())
+            {
+                visit(rec.first, rec.second);
+            }
+        }
+    }
+
+    // Count and aggregates of the records with keys on [from, to], the shards are summarized in parallel
+    ZoneMap RangeAggregate(int from, int to)
+    {
+        std::vector<std::future<ZoneMap>> parts;
+
+        for (int i = ShardOf(from); i <= ShardOf(to); i++)
         {
-            int pos = actualBlock.AddRecord(rec); // Get the position of the new record
-        
-            if (pos >= 0) // If the position is valid and the block is not full
+            parts.push_back(Post(i, [from, to](Manager<T>& manager) { return manager.RangeAggregate(from, to); }));
+        }
+
+        ZoneMap result;
+
+        for (auto& part : parts)
+        {
+            result.Merge(part.get());
+        }
+
+        return result;
+    }
+
+    // Cache the values of up to (entries) hot keys on each shard (0 disables the caches)
+    void setCache(size_t entries)
+    {
+        for (int i = 0; i < getShards(); i++)
+        {
+            Post(i, [entries](Manager<T>& manager) { manager.setCache(entries); return true; }).wait();
+        }
+    }
+
+    // Wait until all the requests sent before are done
+    void Wait()
+    {
+        std::vector<std::future<bool>> done;
+
+        for (int i = 0; i < getShards(); i++)
+        {
+            done.push_back(Post(i, [](Manager<T>&) { return true; }));
+        }
+
+        for (auto& d : done)
+        {
+            d.wait();
+        }
+    }
+
+    // Sum of the metrics of all the shards
+    ManagerStats Stats()
+    {
+        ManagerStats total;
+
+        for (int i = 0; i < getShards(); i++)
+        {
+            ManagerStats stats = Post(i, [](Manager<T>& manager) { return manager.Stats(); }).get();
+
+            total.adds += stats.adds;
+            total.searches += stats.searches;
+            total.indexProbes += stats.indexProbes;
+            total.recordsCompared += stats.recordsCompared;
+            total.overflowHits += stats.overflowHits;
+            total.overflowMisses += stats.overflowMisses;
+            total.cacheHits += stats.cacheHits;
+            total.cacheMisses += stats.cacheMisses;
+            total.cacheCapacity += stats.cacheCapacity;
+            total.bufferHits += stats.bufferHits;
+            total.flushes += stats.flushes;
+            total.flushRejected += stats.flushRejected;
+            total.bufferSize += stats.bufferSize;
+            total.bufferCapacity += stats.bufferCapacity;
+            total.checksumErrors += stats.checksumErrors;
+            total.arenaBytes += stats.arenaBytes;
+            total.arenaHugeBytes += stats.arenaHugeBytes;
+            total.usedBlocks += stats.usedBlocks;
+            total.maxBlocks += stats.maxBlocks;
+            total.indexEntries += stats.indexEntries;
+            total.overflowSize += stats.overflowSize;
+            total.overflowCapacity += stats.overflowCapacity;
+
+            // The slowest shard bounds the latencies
+            total.addP50 = std::max(total.addP50, stats.addP50);
+            total.addP99 = std::max(total.addP99, stats.addP99);
+            total.addP999 = std::max(total.addP999, stats.addP999);
+            total.searchP50 = std::max(total.searchP50, stats.searchP50);
+            total.searchP99 = std::max(total.searchP99, stats.searchP99);
+            total.searchP999 = std::max(total.searchP999, stats.searchP999);
+        }
+
+        return total;
+    }
+};
+
+// -------------------------------------------------------------
+// ----------------- Workload Classes --------------------------
+// -------------------------------------------------------------
+
+// Zipfian generator over [0, items) (Gray et al., "Quickly generating billion-record synthetic databases", as in YCSB)
+class ZipfianGenerator
+{
+private:
+    long long m_Items;
+    double m_Theta;
+    double m_Alpha;
+    double m_Zetan;
+    double m_Eta;
+
+    static double Zeta(long long n, double theta)
+    {
+        double sum = 0;
+
+        for (long long i = 1; i <= n; i++)
+            sum += 1.0 / std::pow((double)i, theta);
+
+        return sum;
+    }
+public:
+    ZipfianGenerator(long long items, double theta = 0.99) : m_Items(std::max(1LL, items)), m_Theta(theta)
+    {
+        double zeta2 = Zeta(2, m_Theta);
+
+        m_Alpha = 1.0 / (1.0 - m_Theta);
+        m_Zetan = Zeta(m_Items, m_Theta);
+        m_Eta = (1 - std::pow(2.0 / m_Items, 1 - m_Theta)) / (1 - zeta2 / m_Zetan);
+    }
+
+    // (u) is a uniform number on [0, 1)
+    long long Next(double u) const
+    {
+        double uz = u * m_Zetan;
+
+        if (uz < 1.0)
+            return 0;
+
+        if (uz < 1.0 + std::pow(0.5, m_Theta))
+            return 1;
+
+        return std::min(m_Items - 1, (long long)(m_Items * std::pow(m_Eta * u - m_Eta + 1, m_Alpha)));
+    }
+};
+
+enum class KeyDistribution { UNIFORM, ZIPFIAN, LATEST };
+
+struct WorkloadConfig
+{
+    long long records = 100000; // Records loaded before the run
+    long long operations = 1000000;
+    long long warmup = 10000; // Operations (per client) not measured
+    int threads = 4; // Client threads
+
+    double readProportion = 0.95;
+    double insertProportion = 0.05;
+    double scanProportion = 0.0;
+    int scanLength = 100;
+
+    KeyDistribution distribution = KeyDistribution::ZIPFIAN;
+    bool hashKeys = false; // Spread the keys over the key space (as YCSB), else they are sequential IDs
+
+    int shards = 4;
+    int blocks = 4096; // Geometry of each shard
+    int capacity = 64;
+    int overflow = 4096;
+    size_t cache = 0; // Hot keys cached by each shard (0: no cache)
+
+    double interval = 1.0; // Seconds between the reports
+};
+
+// Drives a ShardedManager with a mix of reads, inserts and scans from several clients and
+// reports the throughput over time, the tail latencies and the growth of the file
+class WorkloadRunner
+{
+private:
+    WorkloadConfig m_Config;
+    ShardedManager<std::string> m_Manager;
+    ZipfianGenerator m_Zipf;
+
+    std::atomic<long long> m_Inserted; // Number of the next record to insert
+    std::atomic<long long> m_Done;
+
+    LatencyHistogram m_ReadLatency;
+    LatencyHistogram m_InsertLatency;
+    LatencyHistogram m_ScanLatency;
+
+    static std::vector<int> Bounds(const WorkloadConfig& config)
+    {
+        std::vector<int> bounds;
+
+        // Hashed keys cover all the positive ints, sequential keys the records loaded (the new ones go to the last shard)
+        long long space = config.hashKeys ? INT_MAX : std::max(1LL, config.records);
+
+        for (int i = 1; i < config.shards; i++)
+        {
+            bounds.push_back((int)(space / config.shards * i));
+        }
+
+        return bounds;
+    }
+
+    // Key of the record number (n)
+    int KeyOf(long long n) const
+    {
+        if (!m_Config.hashKeys)
+            return (int)n;
+
+        // FNV-1a of the number, folded on the positive ints
+        uint64_t hash = 14695981039346656037ULL;
+
+        for (int i = 0; i < 8; i++)
+        {
+            hash ^= (n >> (i * 8)) & 0xff;
+            hash *= 1099511628211ULL;
+        }
+
+        return (int)(hash % INT_MAX);
+    }
+
+    // Choose an existing record (record 0 if there is none yet)
+    long long NextRecord(std::mt19937_64& random)
+    {
+        long long inserted = m_Inserted.load(std::memory_order_relaxed);
+
+        if (inserted <= 0)
+            return 0;
+
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(random);
+
+        switch (m_Config.distribution)
+        {
+        case KeyDistribution::UNIFORM:
+            return (long long)(u * inserted);
+        case KeyDistribution::LATEST:
+            return std::max(0LL, inserted - 1 - m_Zipf.Next(u) % inserted);
+        default:
+            return m_Zipf.Next(u) % inserted;
+        }
+    }
+
+    void Client(int id, long long operations)
+    {
+        std::mt19937_64 random(id * 7919 + 17);
+        std::uniform_real_distribution<double> choose(0.0, 1.0);
+
+        for (long long i = 0; i < operations + m_Config.warmup; i++)
+        {
+            double op = choose(random);
+            bool measured = (i >= m_Config.warmup);
+            auto start = std::chrono::steady_clock::now();
+            LatencyHistogram* histogram;
+
+            // The reads and scans need a record, until there is one they insert it
+            if (op < m_Config.insertProportion || m_Inserted.load(std::memory_order_relaxed) == 0)
             {
-                std::string result = "Block " + std::to_string(index);
-                return result;
+                long long n = m_Inserted++;
+                m_Manager.Add(KeyOf(n), "value " + std::to_string(n)).get();
+                histogram = &m_InsertLatency;
+            }
+            else if (op < m_Config.insertProportion + m_Config.scanProportion)
+            {
+                int from = KeyOf(NextRecord(random));
+                int count = 0;
+
+                // The end of the range in 64 bits, the hashed keys are spread on all the ints
+                long long span = (long long)m_Config.scanLength * (m_Config.hashKeys ? (INT_MAX / std::max(1LL, m_Inserted.load())) : 1);
+                int to = (int)std::min<long long>(INT_MAX, from + span);
+
+                m_Manager.Scan(from, to, [&count](int, const std::string&) { count++; });
+                histogram = &m_ScanLatency;
             }
             else
             {
-                return "Error: Record not added";
+                m_Manager.Find(KeyOf(NextRecord(random))).get();
+                histogram = &m_ReadLatency;
+            }
+
+            if (measured)
+            {
+                histogram->Record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+                m_Done++;
+            }
+        }
+    }
+
+    static void ShowLatency(const char* name, const LatencyHistogram& histogram)
+    {
+        if (histogram.Count() == 0)
+            return;
+
+        std::cout << name << ": " << histogram.Count() << " ops => p50/p99/p99.9 (ns): " << histogram.Percentile(50) << "/"
+                  << histogram.Percentile(99) << "/" << histogram.Percentile(99.9) << "\n";
+    }
+public:
+    WorkloadRunner(const WorkloadConfig& config)
+        : m_Config(config), m_Manager(Bounds(config), config.blocks, config.capacity, config.overflow),
+          m_Zipf(std::max(1LL, config.records)), m_Inserted(0), m_Done(0) {}
+
+    void Run()
+    {
+        m_Manager.setCache(m_Config.cache);
+
+        // Load phase
+        std::vector<std::future<bool>> loads;
+        auto loadStart = std::chrono::steady_clock::now();
+
+        for (; m_Inserted < m_Config.records; m_Inserted++)
+        {
+            loads.push_back(m_Manager.Add(KeyOf(m_Inserted), "value " + std::to_string(m_Inserted.load())));
+        }
+
+        long long loaded = 0;
+
+        for (auto& load : loads)
+            loaded += load.get();
+
+        double loadSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - loadStart).count();
+
+        std::cout << "Loaded " << loaded << "/" << m_Config.records << " records in " << loadSeconds << " s\n";
+
+        // Run phase
+        std::cout << "time(s)\tops/s\tblocks\tindex\toverflow\n";
+
+        std::vector<std::thread> clients;
+        auto start = std::chrono::steady_clock::now();
+
+        for (int i = 0; i < m_Config.threads; i++)
+        {
+            long long share = m_Config.operations / m_Config.threads + (i < m_Config.operations % m_Config.threads ? 1 : 0);
+            clients.emplace_back(&WorkloadRunner::Client, this, i, share);
+        }
+
+        long long lastDone = 0;
+        long long target = m_Config.operations;
+
+        while (m_Done < target)
+        {
+            std::this_thread::sleep_for(std::chrono::duration<double>(m_Config.interval));
+
+            long long done = m_Done;
+            ManagerStats stats = m_Manager.Stats();
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            std::cout << elapsed << "\t" << (long long)((done - lastDone) / m_Config.interval) << "\t" << stats.usedBlocks << "/" << stats.maxBlocks
+                      << "\t" << stats.indexEntries << "\t" << stats.overflowSize << "/" << stats.overflowCapacity << std::endl;
+
+            lastDone = done;
+        }
+
+        for (auto& client : clients)
+            client.join();
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << "\nThroughput: " << (long long)(m_Done / seconds) << " ops/s (" << m_Done << " ops, " << m_Config.threads << " clients)\n";
+
+        ShowLatency("Read", m_ReadLatency);
+        ShowLatency("Insert", m_InsertLatency);
+        ShowLatency("Scan", m_ScanLatency);
+
+        ManagerStats stats = m_Manager.Stats();
+
+        std::cout << "Blocks: " << stats.usedBlocks << "/" << stats.maxBlocks << " => Index entries: " << stats.indexEntries
+                  << " => Overflow: " << stats.overflowSize << "/" << stats.overflowCapacity << " => Overflow hit rate: " << stats.OverflowHitRate() << std::endl;
+
+        if (stats.cacheCapacity > 0)
+            std::cout << "Cache: " << stats.cacheCapacity << " entries => Hit rate: " << stats.CacheHitRate() << std::endl;
+    }
+
+    // Read the settings from "name=value" arguments, returns false on an unknown setting
+    static bool Parse(int argc, char** argv, WorkloadConfig& config)
+    {
+        for (int i = 0; i < argc; i++)
+        {
+            std::string arg = argv[i];
+            size_t eq = arg.find('=');
+
+            if (eq == std::string::npos)
+                return false;
+
+            std::string name = arg.substr(0, eq);
+            std::string value = arg.substr(eq + 1);
+
+            if (name == "records") config.records = std::stoll(value);
+            else if (name == "ops") config.operations = std::stoll(value);
+            else if (name == "warmup") config.warmup = std::stoll(value);
+            else if (name == "threads") config.threads = std::max(1, std::stoi(value));
+            else if (name == "read") config.readProportion = std::stod(value);
+            else if (name == "insert") config.insertProportion = std::stod(value);
+            else if (name == "scan") config.scanProportion = std::stod(value);
+            else if (name == "scanlength") config.scanLength = std::stoi(value);
+            else if (name == "dist") config.distribution = (value == "uniform") ? KeyDistribution::UNIFORM : (value == "latest") ? KeyDistribution::LATEST : KeyDistribution::ZIPFIAN;
+            else if (name == "hashed") config.hashKeys = (value != "0");
+            else if (name == "shards") config.shards = std::max(1, std::stoi(value));
+            else if (name == "blocks") config.blocks = std::stoi(value);
+            else if (name == "cap") config.capacity = std::stoi(value);
+            else if (name == "overflow") config.overflow = std::stoi(value);
+            else if (name == "cache") config.cache = std::stoull(value);
+            else if (name == "interval") config.interval = std::stod(value);
+            else return false;
+        }
+
+        // The proportions are relative to their sum
+        double total = config.readProportion + config.insertProportion + config.scanProportion;
+
+        if (total <= 0)
+            return false;
+
+        config.readProportion /= total;
+        config.insertProportion /= total;
+        config.scanProportion /= total;
+
+        return true;
+    }
+};
+
+// -------------------------------------------------------------
+// ----------------- Benchmark Functions -----------------------
+// -------------------------------------------------------------
+
+// Compare the search modes of the IndexArea on an index of (entries) mostly monotonic keys with small gaps
+void BenchmarkIndex(int entries, int lookups)
+{
+    std::mt19937 random(42);
+    std::uniform_int_distribution<int> gap(1, 8);
+
+    std::vector<int> keys;
+    int key = 0;
+
+    for (int i = 0; i < entries; i++)
+    {
+        keys.push_back(key);
+        key += gap(random);
+    }
+
+    std::vector<int> queries;
+    std::uniform_int_distribution<int> query(-10, key + 10);
+
+    for (int i = 0; i < lookups; i++)
+    {
+        queries.push_back(query(random));
+    }
+
+    struct ModeName { IndexMode mode; const char* name; };
+    std::vector<ModeName> modes = { { IndexMode::LINEAR, "linear" }, { IndexMode::BINARY, "binary" },
+                                    { IndexMode::TREE, "tree" }, { IndexMode::LEARNED, "learned" },
+                                    { IndexMode::EYTZINGER, "eytzinger" }, { IndexMode::INTERPOLATION, "interpolation" } };
+
+    std::vector<int> expected;
+
+    std::cout << "mode\tns/lookup\tprobes/lookup\tbytes\tcheck\n";
+
+    for (auto& m : modes)
+    {
+        // The linear scan is too slow for big indexes, it only checks a part of the lookups
+        int count = (m.mode == IndexMode::LINEAR) ? std::min(lookups, std::max(1, 20000000 / std::max(1, entries))) : lookups;
+
+        IndexArea<std::string> index(nullptr);
+        index.setMode(m.mode);
+
+        // Built incrementally, as the Manager does when it opens new blocks
+        for (int i = 0; i < entries; i++)
+        {
+            index.UpdateIndex(i, keys[i]);
+        }
+
+        long long probes = 0;
+        std::vector<int> results(count);
+
+        auto start = std::chrono::steady_clock::now();
+
+        for (int i = 0; i < count; i++)
+        {
+            int p = 0;
+            results[i] = index.getIndexBlock(queries[i], &p);
+            probes += p;
+        }
+
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / count;
+
+        bool ok = true;
+
+        if (expected.empty())
+            expected = results;
+
+        for (int i = 0; i < std::min(count, (int)expected.size()); i++)
+        {
+            ok = ok && (results[i] == expected[i]);
+        }
+
+        std::cout << m.name << "\t" << ns << "\t" << (double)probes / count << "\t" << index.MemoryUsage()
+                  << "\t" << (ok ? "ok" : "MISMATCH");
+
+        if (m.mode == IndexMode::LEARNED)
+            std::cout << " (" << index.getSegments() << " segments)";
+
+        std::cout << std::endl;
+    }
+}
+
+// -------------------------------------------------------------
+// ----------------- Check Functions ---------------------------
+// -------------------------------------------------------------
+
+// Add (records) keys in order and a tenth of keys between them in random order (some of them go to
+// the overflow area, some are rejected). (keys) gets the keys that were added, sorted
+void FillCheck(Manager<std::pmr::string>& m, int records, std::vector<int>& keys)
+{
+    std::mt19937 random(11);
+
+    for (int i = 0; i < records; i++)
+    {
+        if (m.Add(3 * i, std::pmr::string("value " + std::to_string(3 * i))))
+            keys.push_back(3 * i);
+    }
+
+    std::vector<int> between(records);
+
+    for (int i = 0; i < records; i++)
+        between[i] = 3 * i + 1;
+
+    std::shuffle(between.begin(), between.end(), random);
+
+    for (int i = 0; i < records / 10; i++)
+    {
+        if (m.Add(between[i], std::pmr::string("value " + std::to_string(between[i]))))
+            keys.push_back(between[i]);
+    }
+
+    std::sort(keys.begin(), keys.end());
+}
+
+// Print a result of CheckScans, returns 1 if it is wrong
+int CheckResult(const char* name, long long result, long long expected)
+{
+    std::cout << name << ":\t" << result << "\t" << (result == expected ? "ok" : "MISMATCH (expected " + std::to_string(expected) + ")") << std::endl;
+
+    return (result != expected) ? 1 : 0;
+}
+
+// Contents of a file (empty if it can't be read)
+std::string ReadContents(const std::string& path)
+{
+    MappedFile file;
+
+    if (!file.Open(path) || file.getData() == nullptr)
+        return std::string();
+
+    return std::string(file.getData(), file.getSize());
+}
+
+// Fill a Manager on each mode of the index with keys out of order and search all of them.
+// The keys in between the first ones open new blocks whose entries go in the middle of the
+// index, so the learned and Eytzinger structures are rebuilt from there. Returns the number of
+// modes with wrong results
+int CheckIndexModes(int records)
+{
+    struct ModeName { IndexMode mode; const char* name; };
+    std::vector<ModeName> modes = { { IndexMode::LINEAR, "linear" }, { IndexMode::BINARY, "binary" },
+                                    { IndexMode::TREE, "tree" }, { IndexMode::LEARNED, "learned" },
+                                    { IndexMode::EYTZINGER, "eytzinger" }, { IndexMode::INTERPOLATION, "interpolation" } };
+
+    int failed = 0;
+
+    for (auto& m : modes)
+    {
+        Manager<std::pmr::string> manager(records / 4 + 16, 16, records / 10 + 64);
+        manager.setVerbose(false);
+        manager.setIndexMode(m.mode);
+
+        std::mt19937 random(3);
+        std::vector<int> keys;
+
+        // One key every 8 in order, then the keys in between in random order
+        std::vector<int> between;
+
+        for (int i = 0; i < records; i++)
+        {
+            if (i % 8 == 0)
+            {
+                if (manager.Add(2 * i, std::pmr::string("value")))
+                    keys.push_back(2 * i);
             }
+            else
+            {
+                between.push_back(2 * i);
+            }
+        }
+
+        std::shuffle(between.begin(), between.end(), random);
+
+        for (int key : between)
+        {
+            if (manager.Add(key, std::pmr::string("value")))
+                keys.push_back(key);
         }
 
-        // int pos = actualBlock.AddRecord(rec); // Get the position of the new record
-        
-        // if (pos >= 0) // If the position is valid and the block is not full
-        // {
-        //     std::string result = "Block " + std::to_string(index);
-        //     return result;
-        // }
-        // else // If the block is full
-        // {
-        //     // Try to add a new block
-        //     int index2 = AddBlock();
+        // The even keys added must be found, the odd ones (never added) must not
+        int wrong = 0;
+        std::pmr::string value;
+
+        for (int key : keys)
+            wrong += !manager.Find(key, value);
+
+        for (int i = 0; i < records; i++)
+            wrong += manager.Find(2 * i + 1, value);
+
+        std::string name = std::string("Index ") + m.name + " lookups wrong (" + std::to_string(keys.size()) + " keys, "
+            + std::to_string(manager.Stats().indexEntries) + " entries)";
+
+        failed += CheckResult(name.c_str(), wrong, 0);
+    }
+
+    return failed;
+}
+
+// Run the whole-file operations (parallel scans, export and import) on (records) records and
+// compare their results with the keys that were added. The exports are written on (prefix).*
+// and removed at the end. Returns the number of wrong results
+int CheckScans(int records, const std::string& prefix)
+{
+    Manager<std::pmr::string> m(records / 32 + 16, 64, records / 10 + 64);
+    m.setVerbose(false);
+
+    std::vector<int> keys;
+    FillCheck(m, records, keys);
+
+    long long keySum = 0;
+
+    for (int key : keys)
+        keySum += key;
+
+    int failed = 0;
+
+    // Parallel visit and fold
+    std::atomic<long long> visited(0), visitedSum(0);
 
-        //     if (index2 != -1)
-        //     {
-        //         Block<T>& newBlock = m_Blocks[index2];
-                
-        //         int pos2 = newBlock.AddRecord(rec);
-                
-        //         if (pos2 < 0)
-        //         {
-        //             return "Error: New block is full";
-        //         }
+    m.ForEach([&](const RecordView<std::pmr::string>& view)
+    {
+        visited++;
+        visitedSum += view.getKey();
+    });
 
-        //         std::string result = "Block " + std::to_string(index2);
-        //         return result;
-        //     }
-        //     else // No more blocks can be added, so the record will be added to the overflow area
-        //     {
-        //         return AddOverflow(rec);
-        //     } 
-        // }
+    failed += CheckResult("ForEach count", visited, keys.size());
+    failed += CheckResult("ForEach key sum", visitedSum, keySum);
+
+    long long reduced = m.Reduce(0LL, [](long long acc, const RecordView<std::pmr::string>& view) { return acc + view.getKey(); },
+                                 [](long long a, long long b) { return a + b; });
+
+    failed += CheckResult("Reduce key sum", reduced, keySum);
+
+    // Range counts from the zone maps, against a count of the keys on each range
+    std::mt19937 random(5);
+    int wrongRanges = 0;
+
+    for (int i = 0; i < 1000; i++)
+    {
+        int from = (int)(random() % (3LL * records + 20)) - 10;
+        int to = from + (int)(random() % 2000);
+
+        auto first = std::lower_bound(keys.begin(), keys.end(), from);
+        auto last = std::upper_bound(keys.begin(), keys.end(), to);
+        int expected = last - first;
+
+        ZoneMap zone = m.RangeAggregate(from, to);
+
+        bool right = zone.count == expected && m.RangeCount(from, to) == expected
+            && (expected == 0 || (zone.minKey == *first && zone.maxKey == *(last - 1)));
+
+        wrongRanges += !right;
     }
 
-    std::string AddOverflow(const Record<T>& rec)
+    failed += CheckResult("RangeCount wrong ranges", wrongRanges, 0);
+
+    // Export and import back, in both formats. The chunks of ExportChunks put together are the same file
+    for (ExportFormat format : { ExportFormat::CSV, ExportFormat::BINARY })
     {
-        if (OverflowArea.IsFull())
+        bool csv = (format == ExportFormat::CSV);
+        std::string path = prefix + (csv ? ".csv" : ".bin");
+
+        if (!m.Export(path, format))
         {
-            return "Error: Overflow is full";
+            failed += CheckResult(csv ? "Export csv" : "Export bin", -1, 0);
+            continue;
         }
 
-        // Add the record to the overflow area
-        int pos = OverflowArea.AddRecord(rec);
-        
-        if (pos < 0)
+        Manager<std::pmr::string> imported(2 * (records / 32 + 16), 64, records / 10 + 64);
+        imported.setVerbose(false);
+
+        long long added = imported.Import(path, format);
+        long long importedSum = imported.Reduce(0LL, [](long long acc, const RecordView<std::pmr::string>& view) { return acc + view.getKey(); },
+                                                [](long long a, long long b) { return a + b; });
+
+        failed += CheckResult(csv ? "Import csv count" : "Import bin count", added, keys.size());
+        failed += CheckResult(csv ? "Import csv key sum" : "Import bin key sum", importedSum, keySum);
+
+        int chunks = m.ExportChunks(path, format, 16);
+        std::string joined;
+
+        for (int i = 0; i < chunks; i++)
         {
-            return "Error: Overflow is full, can't be added";
+            joined += ReadContents(path + "." + std::to_string(i));
+            std::remove((path + "." + std::to_string(i)).c_str());
         }
-        
-        // Update the direction of the previous record
-        UpdateDir(rec.getKey());
 
-        return "Overflow Block";
+        std::string whole = ReadContents(path);
+        std::remove(path.c_str());
+
+        failed += CheckResult(csv ? "ExportChunks csv same" : "ExportChunks bin same", chunks > 0 && joined == whole, 1);
     }
 
-    void UpdateDir(int key)
+    return failed;
+}
+
+// Export to CSV and import back the values that the text format must keep: doubles with a
+// fractional part, and strings with new lines, commas and quotes (about 100 bytes each, so the
+// import of a few thousand of them is cut in several chunks). Returns the number of wrong checks
+int CheckExportValues(int records, const std::string& prefix)
+{
+    int failed = 0;
+    int blocks = records / 32 + 16;
+    std::string path = prefix + ".values.csv";
+
+    // Doubles
     {
-        // I will search for the record previous to the new one
+        Manager<double> m(blocks, 64, 64), imported(blocks, 64, 64);
+        m.setVerbose(false);
+        imported.setVerbose(false);
 
-        // Search for the record
-        Record<T>* m_Rec = FindRecord(key);
+        for (int i = 0; i < records; i++)
+            m.Add(i, i / 7.0 + 0.1);
 
-        if (m_Rec != nullptr)
+        m.Export(path, ExportFormat::CSV);
+        imported.Import(path, ExportFormat::CSV);
+
+        int wrong = 0;
+
+        for (int i = 0; i < records; i++)
         {
-            m_Rec->setDirection(OVER);
+            double value = 0;
+            wrong += !imported.Find(i, value) || value != i / 7.0 + 0.1;
         }
 
+        failed += CheckResult("Import csv doubles wrong", wrong, 0);
     }
 
-    Record<T>* FindRecord(int key)
+    // Strings that are written quoted
     {
-        Record<T>* prevRec = nullptr;
+        Manager<std::pmr::string> m(blocks, 64, 64), imported(blocks, 64, 64);
+        m.setVerbose(false);
+        imported.setVerbose(false);
 
-        // Search for the record that has the key greater than the new one
-        for (auto& blocks : m_Blocks)
+        auto valueOf = [](int i)
         {
-            for (auto& rec : blocks.getRecords())
-            {
-                if (rec.getKey() < key)
-                {
-                    if (prevRec == nullptr || rec.getKey() > prevRec->getKey())
-                    {
-                        prevRec = &rec;
-                    }
-                }
-            }
+            return "line " + std::to_string(i) + "\n" + std::string(64 + i % 32, 'a' + i % 26) + "\nlast, \"quoted\" ";
+        };
+
+        for (int i = 0; i < records; i++)
+            m.Add(i, std::pmr::string(valueOf(i)));
+
+        m.Export(path, ExportFormat::CSV);
+        imported.Import(path, ExportFormat::CSV);
+
+        int wrong = 0;
+
+        for (int i = 0; i < records; i++)
+        {
+            std::pmr::string value;
+            wrong += !imported.Find(i, value) || value != std::pmr::string(valueOf(i));
         }
 
-        return prevRec;
+        failed += CheckResult("Import csv new lines wrong", wrong, 0);
     }
-};
+
+    std::remove(path.c_str());
+
+    return failed;
+}
 
 // -------------------------------------------------------------
-// ----------------- IndexArea Class ---------------------------
+// ----------------- Main Function -----------------------------
 // -------------------------------------------------------------
 
-template <typename T>
-class IndexArea
+int main(int argc, char** argv)
 {
-private:
-    std::vector<std::pair<int, int>> key_dir;
-    DataArea<T>* m_Area;
-public:
-    IndexArea(DataArea<T>* area) : m_Area(area) {}
+    // Index benchmark: --bench-index [entries] [lookups]
+    if (argc > 1 && std::string(argv[1]) == "--bench-index")
+    {
+        BenchmarkIndex((argc > 2) ? std::atoi(argv[2]) : 100000, (argc > 3) ? std::atoi(argv[3]) : 1000000);
+        return 0;
+    }
 
-    std::vector<std::pair<int, int>>& getKeyDir() { return key_dir; }
+    // Checks: --check [records] [prefix]. Compares the results of the whole-file operations and of
+    // the index modes with the keys added, the exports are written on prefix.* (/tmp/indexfile_check by default)
+    if (argc > 1 && std::string(argv[1]) == "--check")
+    {
+        int records = (argc > 2) ? std::atoi(argv[2]) : 20000;
+
+        int failed = CheckScans(records, (argc > 3) ? argv[3] : "/tmp/indexfile_check");
+        failed += CheckExportValues(records, (argc > 3) ? argv[3] : "/tmp/indexfile_check");
+        failed += CheckIndexModes(records);
+
+        return (failed == 0) ? 0 : 1;
+    }
 
-    int getIndexBlock(int key)
+    // Export: --export <path> <csv|bin> <records>. Writes a file of (records) keys that --import reads
+    if (argc > 4 && std::string(argv[1]) == "--export")
     {
-        if (key_dir.empty()) // Return the first block if the index is empty
-            return 0;
+        int records = std::atoi(argv[4]);
 
-        int indexBlock = 0;
+        Manager<std::pmr::string> m_Exported(records / 32 + 16, 64, records / 10 + 64);
+        m_Exported.setVerbose(false);
+
+        std::vector<int> keys;
+        FillCheck(m_Exported, records, keys);
 
-        for (int i = 0; i < key_dir.size(); i++)
+        ExportFormat format = (std::string(argv[3]) == "bin") ? ExportFormat::BINARY : ExportFormat::CSV;
+
+        if (!m_Exported.Export(argv[2], format))
         {
-            if (key_dir[i].first <= key)
-            {
-                indexBlock = key_dir[i].second;
-            }
-            else
-            {
-                break;
-            }
+            std::cout << "Error exporting " << argv[2] << std::endl;
+            return 1;
         }
 
-        return indexBlock;
+        std::cout << "Exported " << keys.size() << " records to " << argv[2] << std::endl;
+
+        return 0;
     }
 
-    void UpdateIndex(int indexBlock, int key)
+    // Workload: --ycsb [records=N] [ops=N] [threads=N] [read=P] [insert=P] [scan=P] [dist=uniform|zipfian|latest] ...
+    if (argc > 1 && std::string(argv[1]) == "--ycsb")
     {
-        // Search for the indexBlock in the index (key_dir vector)
-        auto it = std::find_if(key_dir.begin(), key_dir.end(), [indexBlock](auto& pair) { return pair.second == indexBlock; });
+        WorkloadConfig config;
 
-        if (it != key_dir.end()) // If the indexBlock is found
-        {
-            it->first = key; // Update the key
-        }
-        else // If the indexBlock is not found
+        if (!WorkloadRunner::Parse(argc - 2, argv + 2, config))
         {
-            key_dir.push_back({ key, indexBlock}); // Add the new key and indexBlock
+            std::cout << "Invalid workload settings" << std::endl;
+            return 1;
         }
 
-        // Sort the index
-        std::sort(key_dir.begin(), key_dir.end(), [](auto& a, auto& b) { return a.first < b.first; });
+        WorkloadRunner runner(config);
+        runner.Run();
+
+        return 0;
     }
-};
 
-// -------------------------------------------------------------
-// ----------------- Manager Class --------------------------------
-// -------------------------------------------------------------
+    // Replication: --replicate <records> <checkpoint path>. Half of the records are added and
+    // checkpointed, then a follower process loads the checkpoint, catches up and follows the rest
+    if (argc > 3 && std::string(argv[1]) == "--replicate")
+    {
+        int records = std::atoi(argv[2]);
+        std::string path = argv[3];
 
-template<typename T>
-class Manager
-{
-private:
-    IndexArea<T> m_IndexArea;
-    DataArea<T> m_DataArea;
+        Manager<std::pmr::string> m_Primary(4096, 64, 4096);
+        m_Primary.setVerbose(false);
 
-public:
+        ReplicationPrimary<std::pmr::string> primary(m_Primary);
+
+        for (int i = 0; i < records / 2; i++)
+            primary.Add(i * 2, std::pmr::string("value " + std::to_string(i)));
+
+        std::cout << "Checkpoint at sequence " << m_Primary.getSequence() << ": " << (primary.Checkpoint(path) ? "ok" : "error") << std::endl;
 
-    Manager(int nBlocks, int cap, int capOverflow) 
-        : m_DataArea(cap, nBlocks, capOverflow), m_IndexArea(&m_DataArea) 
+        // Added before the follower exists, shipped on its catch-up
+        for (int i = records / 2; i < records * 3 / 4; i++)
+            primary.Add(i * 2, std::pmr::string("value " + std::to_string(i)));
+
+        int fds[2];
+
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
         {
-            if (!m_DataArea.getBlocks().empty())
-            {
-                m_IndexArea.UpdateIndex(0, -1);
-            }
+            std::cout << "Error creating the socket pair" << std::endl;
+            return 1;
         }
 
-    void Add(int key, T value)
-    {
-        Record<T> rec(key, value);
-
-        // Get the index of the block
-        int indexBlock = m_IndexArea.getIndexBlock(key);
+        signal(SIGPIPE, SIG_IGN); // A follower that exits shows up as a failed write
 
-        // Add the record to the Data Area
-        std::string result = m_DataArea.AddRecordToData(indexBlock, rec);
+        pid_t pid = fork();
 
-        if (result == "Overflow Block"
-            || (result.rfind("Block", 0) == 0)) // If the record was added successfully
+        if (pid == 0)
         {
-            std::cout << "Key " << key << " added successfully in " << result << std::endl;
-            
-            // It only updates the index if it was inserted in a main block
-            if (result.rfind("Block", 0) == 0)
-            {
-                int pos = result.find(" "); // Find the position of the space after "Block"
-                int index = std::stoi(result.substr(pos + 1)); // Get the index of the block
+            close(fds[0]);
 
-                auto blocks = m_DataArea.getBlocks();
-                auto& block = blocks[index];
+            ReplicationFollower<std::pmr::string> follower(4096, 64, 4096);
 
-                // Check if the block is not empty and update the index
-                if (!block.getRecords().empty())
-                {
-                    int newKey = block.getRecords()[0].getKey(); // Get the first key of the block to update the index
-                    m_IndexArea.UpdateIndex(index, newKey);
-                }
+            if (!follower.Attach(fds[1], path))
+            {
+                std::cout << "Follower: error loading " << path << std::endl;
+                _exit(1);
             }
+
+            follower.Run();
+
+            long long count = 0, keys = 0;
+            follower.Scan(INT_MIN, INT_MAX, [&](const Record<std::pmr::string>& rec) { count++; keys += rec.getKey(); });
+
+            std::pmr::string value;
+            bool found = follower.Find((records - 1) * 2, value);
+
+            std::cout << "Follower: sequence " << follower.getSequence() << ", " << count << " records, sum of keys " << keys
+                      << ", last key => " << (found ? value : std::pmr::string("not found")) << std::endl;
+            _exit(0);
         }
-        else
+
+        close(fds[1]);
+
+        if (pid < 0 || !primary.Attach(fds[0]))
         {
-            std::cout << "Error adding key " << key << " => (" << result << ")" << std::endl;
+            std::cout << "Error attaching the follower" << std::endl;
+            return 1;
         }
+
+        for (int i = records * 3 / 4; i < records; i++)
+            primary.Add(i * 2, std::pmr::string("value " + std::to_string(i)));
+
+        primary.Sync();
+
+        long long count = 0, keys = 0;
+        m_Primary.Scan(INT_MIN, INT_MAX, [&](const Record<std::pmr::string>& rec) { count++; keys += rec.getKey(); });
+
+        std::cout << "Primary: sequence " << m_Primary.getSequence() << ", " << count << " records, sum of keys " << keys
+                  << ", batches " << primary.getBatches() << ", lag peak " << primary.getLagPeak() << ", lag " << primary.getLag() << std::endl;
+
+        close(fds[0]); // The follower stops at the end of the stream
+        waitpid(pid, nullptr, 0);
+
+        return 0;
     }
 
-    void Search(int key)
+    // Shared reads: --shared <path> <records> [readers]. This process adds the records and shares
+    // them every 1000 adds on the file (e.g. on /dev/shm), the reader processes search it meanwhile
+    if (argc > 3 && std::string(argv[1]) == "--shared")
     {
-        int indexBlock = m_IndexArea.getIndexBlock(key);
+        std::string path = argv[2];
+        int records = std::atoi(argv[3]);
+        int readers = (argc > 4) ? std::atoi(argv[4]) : 2;
 
-        if (indexBlock < 0 || indexBlock >= m_DataArea.getUsedBlocks())
+        Manager<std::pmr::string> m_Writer(4096, 64, 4096);
+        m_Writer.setVerbose(false);
+
+        SharedArea shared;
+
+        if (!shared.Create(path, 64, 4096, 4096) || !m_Writer.Share(shared))
         {
-            std::cout << "Record with key " << key << " not found (invalid block)." << std::endl;
-            return;
+            std::cout << "Error creating " << path << std::endl;
+            return 1;
         }
 
-        // Search in the main block
-        auto& block = m_DataArea.getBlocks()[indexBlock];
+        std::vector<pid_t> pids;
 
-        for (auto& rec : block.getRecords())
+        for (int r = 0; r < readers; r++)
         {
-            if (rec.getKey() == key)
+            pid_t pid = fork();
+
+            if (pid == 0)
             {
-                std::cout << "Record found (Block " << indexBlock << "): "
-                          << "key = " << rec.getKey() << ", value = " << rec.getValue() 
-                          << ", dir = " << rec.getDirection() << std::endl;
-                return;
+                SharedReader<std::pmr::string> reader;
+
+                if (!reader.Open(path))
+                    _exit(1);
+
+                std::mt19937 random(r);
+                std::pmr::string value;
+                long long lookups = 0, found = 0;
+
+                // Every record shared (key 2 * i for i < sequence) must be found
+                for (uint64_t visible = reader.getSequence(); visible < (uint64_t)records; visible = reader.getSequence())
+                {
+                    if (visible == 0)
+                        continue;
+
+                    lookups++;
+                    found += reader.Find(2 * (int)(random() % visible), value);
+                }
+
+                long long scanned = 0;
+                reader.Scan(INT_MIN, INT_MAX, [&scanned](int, const std::pmr::string&) { scanned++; });
+
+                std::cout << "Reader " << r << ": " << found << "/" << lookups << " found while adding, "
+                          << scanned << " records scanned, " << reader.getRetries() << " retries" << std::endl;
+                _exit(0);
             }
+
+            pids.push_back(pid);
         }
 
-        // If the record is not in the main block, search in the overflow area
-        auto over = m_DataArea.getOverflow();
+        auto start = std::chrono::steady_clock::now();
 
-        for (auto& rec : over.getRecords())
+        for (int i = 0; i < records; i++)
         {
-            if (rec.getKey() == key)
-            {
-                std::cout << "Record found in the Overflow Area: "
-                          << "key = " << rec.getKey() << ", value = " << rec.getValue() 
-                          << ", dir = " << rec.getDirection() << std::endl;
-                return;
-            }
+            m_Writer.Add(2 * i, std::pmr::string("value " + std::to_string(i)));
+
+            if ((i + 1) % 1000 == 0 || i + 1 == records)
+                m_Writer.Share(shared);
         }
 
-        // If the record is not in the overflow area either
-        std::cout << "Record with key " << key << " not found." << std::endl;
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        for (pid_t pid : pids)
+            waitpid(pid, nullptr, 0);
+
+        std::cout << "Writer: " << m_Writer.getSequence() << " records added and shared in " << seconds << " s" << std::endl;
+
+        return 0;
     }
 
-    void Show()
+    // Verify: --verify <path>. Checks the checksums of the header and the pages of a checkpoint file
+    if (argc > 2 && std::string(argv[1]) == "--verify")
     {
-        std::cout << "\n--- Index Area ---" << std::endl;
+        std::vector<int> bad;
 
-        for (auto& pair : m_IndexArea.getKeyDir())
+        auto start = std::chrono::steady_clock::now();
+        long long errors = VerifyFile(argv[2], &bad);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (errors < 0)
         {
-            std::cout << "Key: " << pair.first << " => Dir: " << (pair.second * N) << std::endl;
+            std::cout << "Error reading " << argv[2] << std::endl;
+            return 1;
         }
 
-        ShowDataArea();
+        std::cout << "CRC32C: " << (Crc32cHasHardware() ? "sse4.2" : "tables") << ", " << errors << " bad pages (" << seconds << " s)";
+
+        for (size_t i = 0; i < bad.size() && i < 16; i++)
+            std::cout << (i == 0 ? ": " : ", ") << bad[i];
+
+        std::cout << std::endl;
+
+        return errors == 0 ? 0 : 2;
     }
 
-    void ShowDataArea()
+#if defined(__cpp_impl_coroutine)
+    // Coroutines: --async <path> <records> <lookups>. The records are checkpointed on the file and
+    // all the lookups are started at once on one thread, they wait for their pages on the loop
+    if (argc > 4 && std::string(argv[1]) == "--async")
     {
-        std::cout << "\n--- Data Area ---" << std::endl;
+        std::string path = argv[2];
+        int records = std::atoi(argv[3]);
+        int lookups = std::atoi(argv[4]);
 
-        int i = 0;
+        Manager<std::pmr::string> m_Async(4096, 64, 4096);
+        m_Async.setVerbose(false);
 
-        // Show all the blocks in the Main Area
+        for (int i = 0; i < records; i++)
+            m_Async.Add(2 * i, std::pmr::string("value " + std::to_string(i)));
 
-        for (auto& block : m_DataArea.getBlocks())
-        {
-            std::cout << "Block: " << i++ << std::endl;
+        BlockFile file;
 
-            for (auto& rec : block.getRecords())
-            {
-                std::cout << "\t~ Key: " << rec.getKey() << " => Value: " << rec.getValue() << " => Direction: " << rec.getDirection() << std::endl;
-            }
+        if (!m_Async.Checkpoint(path) || !file.Open(path, false, 256))
+        {
+            std::cout << "Error writing " << path << std::endl;
+            return 1;
         }
 
-        // Show the Overflow Area
+        LoopExecutor loop(&file);
+        std::mt19937 random(1);
+        std::vector<Task<std::optional<std::pmr::string>>> finds;
 
-        std::cout << "\n\t[Overflow Area]" << std::endl;
+        auto start = std::chrono::steady_clock::now();
 
-        auto m_Over = m_DataArea.getOverflow();
-        for (auto& rec : m_Over.getRecords())
+        for (int i = 0; i < lookups; i++)
         {
-            std::cout << "\t~ Key: " << rec.getKey() << " => Value: " << rec.getValue() << " => Direction: " << rec.getDirection() << std::endl;
+            finds.push_back(m_Async.FindAsync(file, (int)(random() % (2 * records)), loop)); // Half of the keys (the odd ones) are misses
+            finds.back().Start();
         }
+
+        auto scan = m_Async.ScanAsync(file, 100, 199, loop);
+        scan.Start();
+
+        loop.Run();
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        long long found = std::count_if(finds.begin(), finds.end(), [](auto& find) { return find.getResult().has_value(); });
+
+        std::cout << "Lookups: " << found << "/" << lookups << " found in " << seconds << " s (" << file.UsesRing() << " io_uring)" << std::endl;
+        std::cout << "Scan [100, 199]: " << scan.getResult().size() << " records" << std::endl;
+
+        auto add = m_Async.AddAsync(1, std::pmr::string("value odd"), loop);
+        add.Start();
+        loop.Run();
+
+        std::cout << "AddAsync(1): " << (add.getResult() ? "added" : "error") << std::endl;
+
+        return 0;
     }
-};
+#endif
 
-// -------------------------------------------------------------
-// ----------------- Main Function -----------------------------
-// -------------------------------------------------------------
+    // Import: --import <path> <csv|bin> <blocks> <records per block> <overflow records>
+    if (argc > 6 && std::string(argv[1]) == "--import")
+    {
+        Manager<std::pmr::string> m_Imported(std::atoi(argv[4]), std::atoi(argv[5]), std::atoi(argv[6]));
 
-int main()
-{
+        ExportFormat format = (std::string(argv[3]) == "bin") ? ExportFormat::BINARY : ExportFormat::CSV;
+
+        auto start = std::chrono::steady_clock::now();
+        long long added = m_Imported.Import(argv[2], format);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (added < 0)
+        {
+            std::cout << "Error importing " << argv[2] << std::endl;
+            return 1;
+        }
+
+        std::cout << "Imported " << added << " records in " << seconds << " s (" << (added / std::max(seconds, 1e-9)) << " records/s)" << std::endl;
+        m_Imported.ShowStats();
+
+        return 0;
+    }
 
-    Manager<std::string> m_Archive(BLOCKS, N, OMAX);
+    Manager<std::pmr::string> m_Archive(BLOCKS, N, OMAX); // Values are stored on the arena of the Data Area
 
     // Block (0) first
     m_Archive.Add(1, "Value 10");
@@ -514,5 +7044,31 @@ int main()
     std::cout << "\nShowing the Index Area: " << std::endl;
     m_Archive.Show();
 
+    // File test: --file <path> [--direct] saves the Data Area, loads it back and searches the keys on the file
+    if (argc > 2 && std::string(argv[1]) == "--file")
+    {
+        std::string path = argv[2];
+        bool direct = (argc > 3 && std::string(argv[3]) == "--direct");
+
+        std::cout << "\nCheckpoint to " << path << ": " << (m_Archive.Checkpoint(path, direct) ? "ok" : "error") << std::endl;
+
+        Manager<std::pmr::string> m_Loaded(BLOCKS, N, OMAX);
+
+        std::cout << "Load from " << path << ": " << (m_Loaded.Load(path, direct) ? "ok" : "error") << std::endl;
+        m_Loaded.Show();
+
+        BlockFile file;
+
+        if (file.Open(path, false, 64, direct))
+        {
+            std::cout << "\nSearch on the file (" << (file.UsesRing() ? "io_uring" : "pread") << (file.IsDirect() ? ", O_DIRECT" : "") << "): " << std::endl;
+
+            m_Archive.SearchFile(file, { 1, 2, 9, 13, 14, 25 }, [](int key, const std::pmr::string* value)
+            {
+                std::cout << "[~]\tKey " << key << " => " << (value ? *value : std::pmr::string("not found")) << std::endl;
+            });
+        }
+    }
+
     return 0;
 }
\ No newline at end of file
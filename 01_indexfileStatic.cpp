@@ -9,9 +9,17 @@ Integrantes:
 #include <iostream>
 #include <string>
 #include <algorithm>
+#include <utility>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
 
 #define MAX_BLOCKS 10 // Maximum number of blocks
-#define CAPACITY 10 // Number of records per block
+#define CAPACITY 10 // Maximum number of records per block
 #define MAX_OVERFLOW 10 // Maximum number of records in the overflow area
 #define MAX_RECORDS 32 // Maximum number of records
 
@@ -19,9 +27,18 @@ int RECORDS = 9;
 int N = 3;
 int BLOCKS = RECORDS/N;
 int OMAX = 3;
+int FILL = 50; // Percentage of each block filled at load time, the rest is kept free for inserts in the middle of the keys
 
 int OVER = ((N * BLOCKS) + 1);
 
+// Number of records of a block at load time (appends after this open a new block)
+int FillLimit()
+{
+    int limit = (N * FILL + 99) / 100;
+
+    return (limit < 1) ? 1 : limit;
+}
+
 // -------------------------------------------------------------
 // ----------------- Record Class ----------------------------
 // -------------------------------------------------------------
@@ -34,12 +51,12 @@ private:
     T value;
 	int direction;
 public:
-	Record(int key_, T value_) : key(key_), value(value_), direction(-1) {}
+	Record(int key_, T value_) : key(key_), value(std::move(value_)), direction(-1) {}
 
     Record() : key(0), value(), direction(-1) {}
 
     int getKey() const { return key; }
-    T getValue() const { return value; }
+    const T& getValue() const { return value; } // Return a reference, no copy of the value
     int getDirection() const { return direction; }
     void setDirection(int dir) { direction = dir; }
 };
@@ -52,17 +69,27 @@ template <typename T>
 class Block
 {
 private:
-    Record<T> records[CAPACITY];
+    Record<T>* records; // Slots of the block (given by the Data Area when the block is used)
 
     int m_Size;
 
     int m_Capacity;
+
+    int m_Inserts; // Number of inserts routed to this block (used to place the spare blocks)
 public:
-    Block() : m_Size(0), m_Capacity(N) {}
+    Block() : records(nullptr), m_Size(0), m_Capacity(0), m_Inserts(0) {}
 
-    void setCapacity(int cap) { m_Capacity = cap; } // Set the capacity of the block
+    Block(Record<T>* slots, int cap) : records(slots), m_Size(0), m_Capacity(cap), m_Inserts(0) {}
 
-    bool IsFull() { return (m_Size >= CAPACITY); } // Check if the block is full
+    int getInserts() { return m_Inserts; } // Get the number of inserts routed to the block
+
+    void addInsert() { m_Inserts++; }
+
+    int getCapacity() { return m_Capacity; } // Get the capacity of the block
+
+    void setSlots(Record<T>* slots, int cap) { records = slots; m_Capacity = cap; } // Give the slots of the records to the block
+
+    bool IsFull() { return (m_Size >= m_Capacity); } // Check if the block is full
 
     Record<T>* getRecords() { return records; } // Get all the records in the block
 
@@ -70,7 +97,7 @@ public:
 
     void setSize(int size) { m_Size = size; } // Set the size of the block
 
-    int AddRecord(const Record<T>& rec)
+    int AddRecord(Record<T> rec)
     {
         if (!IsFull())
         {
@@ -94,10 +121,10 @@ public:
             // Move the records to the right to make space for the new record
             for (int i = m_Size; i > pos; i--)
             {
-                records[i] = records[i - 1];
+                records[i] = std::move(records[i - 1]);
             }
 
-            records[pos] = rec;
+            records[pos] = std::move(rec);
             m_Size++;
 
             return pos; // Return the position of the new record
@@ -107,6 +134,51 @@ public:
     }
 };
 
+// Bytes of the heap used by a value (the text of a string that doesn't fit inside the string object)
+template <typename V>
+size_t HeapBytes(const V&) { return 0; }
+
+inline size_t HeapBytes(const std::string& value) { return (value.capacity() > std::string().capacity()) ? value.capacity() + 1 : 0; }
+
+// -------------------------------------------------------------
+// ----------------- RecordPool Class --------------------------
+// -------------------------------------------------------------
+
+// Slots of the records of the blocks. They are allocated in chunks of a few blocks when AddBlock
+// hands out a block, so the blocks that are never used don't cost memory
+template <typename T>
+class RecordPool
+{
+private:
+    std::vector<std::unique_ptr<Record<T>[]>> m_Chunks;
+
+    int m_ChunkRecords; // Records of each chunk
+    int m_LastSize; // Records of the last chunk
+    int m_Free; // Records not handed out of the last chunk
+    size_t m_Allocated; // Records of all the chunks
+public:
+    RecordPool(int chunkRecords) : m_ChunkRecords(chunkRecords), m_LastSize(0), m_Free(0), m_Allocated(0) {}
+
+    // Slots for (count) records
+    Record<T>* Allocate(int count)
+    {
+        if (count > m_Free)
+        {
+            m_LastSize = std::max(count, m_ChunkRecords);
+            m_Chunks.emplace_back(new Record<T>[m_LastSize]);
+            m_Free = m_LastSize;
+            m_Allocated += m_LastSize;
+        }
+
+        Record<T>* slots = m_Chunks.back().get() + (m_LastSize - m_Free);
+        m_Free -= count;
+
+        return slots;
+    }
+
+    size_t getAllocated() { return m_Allocated; } // Get the number of records allocated
+};
+
 // -------------------------------------------------------------
 // ----------------- DataArea Class ---------------------------
 // -------------------------------------------------------------
@@ -115,40 +187,96 @@ template <typename T>
 class DataArea
 {
 private:
-    Block<T> m_Blocks[MAX_BLOCKS]; // Array of blocks
+    std::vector<Block<T>> m_Blocks; // Blocks handed out by AddBlock (reserved for BLOCKS, they never move)
     Block<T> OverflowArea; // Overflow block
+
+    RecordPool<T> m_Pool; // Records of the blocks
+    std::unique_ptr<Record<T>[]> m_OverflowRecords; // Records of the overflow area (allocated by the first overflow)
     
     int usedBlocks; // Number of blocks used
-public:
-    DataArea() : usedBlocks(0)
+
+    int lastSplit; // Block created by the last split (-1 if the last insert didn't split a block)
+
+    // Check if the block has received at least the average of inserts (a hot key range)
+    bool IsHot(int index)
     {
-        for (int i = 0; i < BLOCKS; i++)
+        int total = 0;
+
+        for (int i = 0; i < usedBlocks; i++)
         {
-            m_Blocks[i].setCapacity(N);
+            total += m_Blocks[i].getInserts();
         }
-        OverflowArea.setCapacity(OMAX);
+
+        return m_Blocks[index].getInserts() * usedBlocks >= total;
+    }
+
+    // Move the upper half of a full block to a spare block, returns the new block or -1
+    int SplitBlock(int index)
+    {
+        // A block of one record has no upper half (all of it would move and the new record would have no room)
+        if (m_Blocks[index].getSize() < 2)
+        {
+            return -1;
+        }
+
+        int newIndex = AddBlock();
+
+        if (newIndex == -1)
+        {
+            return -1;
+        }
+
+        Block<T>& block = m_Blocks[index];
+        Block<T>& newBlock = m_Blocks[newIndex];
+
+        Record<T>* records = block.getRecords();
+        int size = block.getSize();
+        int half = size / 2;
+
+        for (int i = half; i < size; i++)
+        {
+            newBlock.AddRecord(std::move(records[i]));
+            records[i] = Record<T>();
+        }
+
+        block.setSize(half);
+
+        return newIndex;
+    }
+public:
+    DataArea() : OverflowArea(nullptr, OMAX), m_Pool(4 * N), usedBlocks(0), lastSplit(-1)
+    {
+        m_Blocks.reserve(BLOCKS);
 
         AddBlock(); // Add the first block
     }
 
     int getUsedBlocks() { return usedBlocks; } // Get the number of blocks used
 
-    Block<T>* getBlocks() { return m_Blocks; } // Get all the blocks in the Data Area
+    Block<T>* getBlocks() { return m_Blocks.data(); } // Get the blocks in use of the Data Area
+
+    size_t getBlockBytes() { return m_Blocks.capacity() * sizeof(Block<T>) + m_Pool.getAllocated() * sizeof(Record<T>); } // Memory of the blocks and their records
+
+    size_t getOverflowBytes() { return sizeof(Block<T>) + ((m_OverflowRecords != nullptr) ? OMAX * sizeof(Record<T>) : 0); } // Memory of the overflow area
 
     Block<T>& getOverflow() { return OverflowArea; } // Get the overflow block
 
+    int getLastSplit() { return lastSplit; } // Get the block created by the last split
+
 	// Add a new record to the Data Area
 	int AddBlock()
 	{
         if (usedBlocks < BLOCKS)
         {
+            m_Blocks.emplace_back(m_Pool.Allocate(N), N); // The records of the block are allocated now
+
             return usedBlocks++; 
         }
 
         return -1; // This means that the Data Area is full (no more blocks can be added)
 	}
 
-    std::string AddRecordToData(int index, const Record<T>& rec)
+    std::string AddRecordToData(int index, Record<T> rec)
     {
         if (index < 0 || index >= usedBlocks) 
         {
@@ -157,6 +285,9 @@ public:
 
         Block<T>& actualBlock = m_Blocks[index]; // Get the actual block
 
+        lastSplit = -1;
+        actualBlock.addInsert();
+
         // - Check if the record is trying to be added at the end of the block -
 
         // (1) Get the actual size of the block
@@ -181,8 +312,8 @@ public:
         if (pos == actualSize && actualSize < N)
         {
 
-            // (1.1) If the block is not full we try to add a new block
-            if (actualSize >= (N + 1)/2)
+            // (1.1) If the block reached the fill factor we try to add a new block, the free slots are kept for the keys in the middle
+            if (actualSize >= FillLimit())
             {
 
                 int actualIndex = AddBlock(); 
@@ -192,7 +323,7 @@ public:
                 {
                     Block<T>& newBlock = m_Blocks[actualIndex];
 
-                    int pos2 = newBlock.AddRecord(rec);
+                    int pos2 = newBlock.AddRecord(std::move(rec));
 
                     if (pos2 < 0)
                     {
@@ -204,7 +335,7 @@ public:
             }
 
             // (1.2) If it can't create a new block, we add the record on the current block
-            int actualPos = actualBlock.AddRecord(rec);
+            int actualPos = actualBlock.AddRecord(std::move(rec));
 
             if (actualPos >= 0)
             {
@@ -215,19 +346,40 @@ public:
                 return "Error: Record not added";
             }
         }
-        // (2) If the record is not going to be inserted at the end of the block and the block is almost full ((N + 1)/2) add the record to the overflow area
-        else if (pos != actualSize && actualSize >= (N + 1)/2)
+        // (2) If the block is full (N records), split it if its key range is hot and there are spare blocks, else add the record to the overflow area
+        else if (actualSize >= N)
         {
+            if (IsHot(index))
+            {
+                int newIndex = SplitBlock(index);
+
+                if (newIndex != -1)
+                {
+                    lastSplit = newIndex;
+
+                    // Add the record to the half that holds its key
+                    Block<T>& newBlock = m_Blocks[newIndex];
+                    int target = (rec.getKey() >= newBlock.getRecords()[0].getKey()) ? newIndex : index;
+
+                    if (m_Blocks[target].AddRecord(std::move(rec)) < 0)
+                    {
+                        return "Error: Record not added";
+                    }
+
+                    return "Block " + std::to_string(target);
+                }
+            }
+
             if (actualSize > 0)
             {
                 records[actualSize - 1].setDirection(OVER);
             }
 
-            return AddOverflow(rec);
+            return AddOverflow(std::move(rec));
         }
 
-        // (3) If the record is not going to be inserted at the end of the block and the block is not full, add the record to the block normally
-        int m_Pos = actualBlock.AddRecord(rec);
+        // (3) If the record is not going to be inserted at the end of the block and the block has free slots, add the record to the block normally
+        int m_Pos = actualBlock.AddRecord(std::move(rec));
         
         if (m_Pos >= 0)
         {
@@ -239,15 +391,21 @@ public:
         }
     }
 
-    std::string AddOverflow(const Record<T>& rec)
+    std::string AddOverflow(Record<T> rec)
     {
         if (OverflowArea.IsFull())
         {
             return "Error: Overflow is full";
         }
 
+        if (m_OverflowRecords == nullptr)
+        {
+            m_OverflowRecords.reset(new Record<T>[OMAX]);
+            OverflowArea.setSlots(m_OverflowRecords.get(), OMAX);
+        }
+
         // Add the record to the overflow area
-        int pos = OverflowArea.AddRecord(rec);
+        int pos = OverflowArea.AddRecord(std::move(rec));
         
         if (pos < 0)
         {
@@ -294,6 +452,29 @@ public:
 
         return false;
     }
+
+    // Bytes of the heap used by the values of all the records
+    size_t getValueBytes()
+    {
+        size_t bytes = 0;
+
+        for (int i = 0; i < usedBlocks; i++)
+        {
+            Record<T>* records = m_Blocks[i].getRecords();
+
+            for (int j = 0; j < m_Blocks[i].getSize(); j++)
+            {
+                bytes += HeapBytes(records[j].getValue());
+            }
+        }
+
+        for (int i = 0; i < OverflowArea.getSize(); i++)
+        {
+            bytes += HeapBytes(OverflowArea.getRecords()[i].getValue());
+        }
+
+        return bytes;
+    }
 };
 
 // -------------------------------------------------------------
@@ -304,15 +485,17 @@ template <typename T>
 class IndexArea
 {
 private:
-    std::pair<int, int> key_dir[MAX_BLOCKS];
+    std::vector<std::pair<int, int>> key_dir; // One entry per block in use (reserved for BLOCKS)
 
     DataArea<T>* m_Area;
 
     int index;
 public:
-    IndexArea(DataArea<T>* area) : index(0), m_Area(area) {}
+    IndexArea(DataArea<T>* area) : index(0), m_Area(area) { key_dir.reserve(BLOCKS); }
+
+    std::pair<int, int>* getKeyDir() { return key_dir.data(); }
 
-    std::pair<int, int>* getKeyDir() { return key_dir; }
+    size_t getBytes() { return key_dir.capacity() * sizeof(key_dir[0]); } // Memory of the index
 
     int getIndex() { return index; }
 
@@ -358,7 +541,8 @@ public:
         }
         else
         {
-            key_dir[index++] = { key, indexBlock };
+            key_dir.push_back({ key, indexBlock });
+            index++;
         }
 
         // Sort the index (key_dir vector) with bubble sort
@@ -380,6 +564,17 @@ public:
 // ----------------- Manager Class --------------------------------
 // -------------------------------------------------------------
 
+// Bytes used by a file (Manager::MemoryUsage)
+struct MemoryStats
+{
+    size_t index = 0; // Entries of the index
+    size_t blocks = 0; // Blocks handed out and the slots of their records
+    size_t overflow = 0; // Overflow area (its slots are allocated by the first overflow)
+    size_t values = 0; // Heap used by the values of the records
+
+    size_t Total() const { return index + blocks + overflow + values; }
+};
+
 template<typename T>
 class Manager
 {
@@ -387,10 +582,12 @@ private:
     IndexArea<T> m_IndexArea;
     DataArea<T> m_DataArea;
 
+    bool m_Verbose; // Print the result of each Add and Search
+
 public:
 
     Manager() 
-        : m_DataArea(), m_IndexArea(&m_DataArea) 
+        : m_DataArea(), m_IndexArea(&m_DataArea), m_Verbose(true)
         {
             if (m_DataArea.getUsedBlocks() > 0)
             {
@@ -398,30 +595,44 @@ public:
             }
         }
 
-    void Add(int key, T value)
+    void setVerbose(bool verbose) { m_Verbose = verbose; } // Print (or not) the result of each Add and Search
+
+    bool Add(int key, T value)
     {
 
         // Check if the key exists
         if (m_DataArea.CheckKey(key) == true)
         {
-            std::cout << "\tKey " << key << " already exists." << std::endl;
-            return;
+            if (m_Verbose)
+                std::cout << "\tKey " << key << " already exists." << std::endl;
+
+            return false;
         }
 
-        Record<T> rec(key, value);
+        Record<T> rec(key, std::move(value));
 
         // Get the index of the block
         int indexBlock = m_IndexArea.getIndexBlock(key);
 
-        // Add the record to the Data Area
-        std::string result = m_DataArea.AddRecordToData(indexBlock, rec);
+        // Add the record to the Data Area (the value is moved, not copied, until its final place)
+        std::string result = m_DataArea.AddRecordToData(indexBlock, std::move(rec));
+
+        // If a block was split, the new block needs its entry on the index even if the record wasn't added
+        // (it already holds the upper half of the split block)
+        int split = m_DataArea.getLastSplit();
+
+        if (split != -1)
+        {
+            m_IndexArea.UpdateIndex(split, m_DataArea.getBlocks()[split].getRecords()[0].getKey());
+        }
 
         std::string m_Result = result.substr(0, 6); // This is used to check if the result was "Block "
 
         if (result == "Overflow Block"
             || m_Result == "Block ")
         {
-            std::cout << "\tKey " << key << " added successfully in " << result << std::endl;
+            if (m_Verbose)
+                std::cout << "\tKey " << key << " added successfully in " << result << std::endl;
             
             // It only updates the index if it was inserted in a main block
             if (m_Result == "Block ") // If the record was added in a main block
@@ -439,21 +650,28 @@ public:
                     m_IndexArea.UpdateIndex(index, newKey);
                 }
             }
+
+            return true;
         }
         else // If the record was not added successfully
         {
-            std::cout << "\tError adding key " << key << " => (" << result << ")" << std::endl;
+            if (m_Verbose)
+                std::cout << "\tError adding key " << key << " => (" << result << ")" << std::endl;
+
+            return false;
         }
     }
 
-    void Search(int key)
+    bool Search(int key)
     {
         int indexBlock = m_IndexArea.getIndexBlock(key);
 
         if (indexBlock < 0 || indexBlock >= m_DataArea.getUsedBlocks())
         {
-            std::cout << "\tRecord with key " << key << " not found (invalid block)." << std::endl;
-            return;
+            if (m_Verbose)
+                std::cout << "\tRecord with key " << key << " not found (invalid block)." << std::endl;
+
+            return false;
         }
 
         // Search in the main block
@@ -467,10 +685,11 @@ public:
         {
             if (records[i].getKey() == key)
             {
-                std::cout << "\tRecord found (Block " << indexBlock << "): "
-                          << "key = " << records[i].getKey() << ", value = " << records[i].getValue() 
-                          << ", dir = " << records[i].getDirection() << std::endl;
-                return;
+                if (m_Verbose)
+                    std::cout << "\tRecord found (Block " << indexBlock << "): "
+                              << "key = " << records[i].getKey() << ", value = " << records[i].getValue() 
+                              << ", dir = " << records[i].getDirection() << std::endl;
+                return true;
             }
         }
 
@@ -485,21 +704,45 @@ public:
         {
             if (over_records[i].getKey() == key)
             {
-                std::cout << "\tRecord found in the Overflow Area: "
-                          << "key = " << over_records[i].getKey() << ", value = " << over_records[i].getValue() 
-                          << ", dir = " << over_records[i].getDirection() << std::endl;
-                return;
+                if (m_Verbose)
+                    std::cout << "\tRecord found in the Overflow Area: "
+                              << "key = " << over_records[i].getKey() << ", value = " << over_records[i].getValue() 
+                              << ", dir = " << over_records[i].getDirection() << std::endl;
+                return true;
             }
         }
 
         // If the record is not in the overflow area either
-        std::cout << "\tRecord with key " << key << " not found." << std::endl;
+        if (m_Verbose)
+            std::cout << "\tRecord with key " << key << " not found." << std::endl;
+
+        return false;
+    }
+
+    MemoryStats MemoryUsage()
+    {
+        MemoryStats stats;
+
+        stats.index = sizeof(m_IndexArea) + m_IndexArea.getBytes();
+        stats.blocks = sizeof(m_DataArea) - sizeof(Block<T>) + m_DataArea.getBlockBytes();
+        stats.overflow = m_DataArea.getOverflowBytes();
+        stats.values = m_DataArea.getValueBytes();
+
+        return stats;
+    }
+
+    void ShowMemory()
+    {
+        MemoryStats stats = MemoryUsage();
+
+        std::cout << "\t[*] Memory: " << stats.Total() << " bytes => index: " << stats.index << ", blocks: " << stats.blocks
+                  << ", overflow: " << stats.overflow << ", values: " << stats.values << std::endl;
     }
 
     void Show()
     {
-        std::cout << "\n\t------------------------------------------" << std::endl;
-        std::cout << "\n\t\t~~~ Index Area ~~~ \n" << std::endl;
+        std::cout << "\n\t------------------------------------------\n";
+        std::cout << "\n\t\t~~~ Index Area ~~~ \n\n";
 
         std::pair<int, int>* m_Pair = m_IndexArea.getKeyDir();
 
@@ -507,7 +750,7 @@ public:
 
         for (int i = 0; i < index; i++)
         {
-            std::cout << "\t\t[~] Key: " << m_Pair[i].first << " => Dir: " << (m_Pair[i].second * N) << std::endl;
+            std::cout << "\t\t[~] Key: " << m_Pair[i].first << " => Dir: " << (m_Pair[i].second * N) << "\n";
         }
 
         ShowDataArea();
@@ -515,33 +758,35 @@ public:
 
     void ShowDataArea()
     {
-        std::cout << "\n\t\t-----------------" << std::endl;
-        std::cout << "\n\t\t~~~ Data Area ~~~ \n" << std::endl;
+        std::cout << "\n\t\t-----------------\n";
+        std::cout << "\n\t\t~~~ Data Area ~~~ \n\n";
 
         Block<T>* blocks = m_DataArea.getBlocks();
 
+        Record<T> empty; // Shown for the slots of the blocks not handed out yet
+
         // Show all the blocks in the Main Area
 
         for (int i = 0; i < BLOCKS; i++)
         {
-            std::cout << "\t\tBlock: " << i << std::endl;
+            std::cout << "\t\tBlock: " << i << "\n";
 
-            // Get the current block
-            Block<T>& c_Block = blocks[i];
+            // Get the records of the current block
+            Record<T>* records = (i < m_DataArea.getUsedBlocks()) ? blocks[i].getRecords() : nullptr;
 
-            Record<T>* records = c_Block.getRecords();
-
-            std::cout << "\t------------------------------------------" << std::endl;
+            std::cout << "\t------------------------------------------\n";
             for (int j = 0; j < N; j++)
             {
-                std::cout << "\t~ Key: " << records[j].getKey() << " => Value: " << records[j].getValue() << " => Direction: " << records[j].getDirection() << std::endl;
+                Record<T>& rec = (records != nullptr) ? records[j] : empty;
+
+                std::cout << "\t~ Key: " << rec.getKey() << " => Value: " << rec.getValue() << " => Direction: " << rec.getDirection() << "\n";
             }
-            std::cout << "\t------------------------------------------" << std::endl;
+            std::cout << "\t------------------------------------------\n";
         }
 
         // Show the Overflow Area
 
-        std::cout << "\n\t\t[Overflow Area] \n" << std::endl;
+        std::cout << "\n\t\t[Overflow Area] \n\n";
 
         Block<T>& m_Over = m_DataArea.getOverflow();
 
@@ -549,19 +794,156 @@ public:
 
         for (int i = 0; i < OMAX; i++)
         {
-            std::cout << "\t~ Key: " << over_records[i].getKey() << " => Value: " << over_records[i].getValue() << " => Direction: " << over_records[i].getDirection() << std::endl;
+            Record<T>& rec = (over_records != nullptr) ? over_records[i] : empty;
+
+            std::cout << "\t~ Key: " << rec.getKey() << " => Value: " << rec.getValue() << " => Direction: " << rec.getDirection() << "\n";
         }
-        std::cout << "\n\t------------------------------------------" << std::endl;
+        std::cout << "\n\t------------------------------------------\n";
+
+        std::cout.flush(); // Flush once, not after each line
     }
 
     
 };
 
+// -------------------------------------------------------------
+// ----------------- OpLog Class -------------------------------
+// -------------------------------------------------------------
+
+// Operations of a session, to replay them later without the menu
+
+enum OpType { OP_ADD = 1, OP_SEARCH = 2, OP_SHOW = 3, OP_SETTINGS = 4 };
+
+struct Op
+{
+    int type;
+    int key;
+    std::string value;
+};
+
+#define OPLOG_MAGIC "IDXOPLG1" // First 8 bytes of a binary op-log
+
+// Binary op-log: magic, then for each operation: type (1 byte), key (int32), length of the value (uint32) and the value
+// Text script: one operation per line: "add <key> <value>", "search <key>", "show" or
+// "settings <N> <RECORDS> <BLOCKS> <OMAX> <FILL>" (# starts a comment)
+class OpLog
+{
+private:
+    std::ofstream m_Out;
+public:
+    // Start recording on a new binary op-log
+    bool Open(const std::string& path)
+    {
+        m_Out.open(path, std::ios::binary | std::ios::trunc);
+        m_Out.write(OPLOG_MAGIC, 8);
+
+        return m_Out.good();
+    }
+
+    bool IsOpen() { return m_Out.is_open(); }
+
+    void Append(const Op& op)
+    {
+        if (!m_Out.is_open())
+            return;
+
+        uint8_t type = (uint8_t)op.type;
+        int32_t key = op.key;
+        uint32_t length = (uint32_t)op.value.size();
+
+        m_Out.write((const char*)&type, sizeof(type));
+        m_Out.write((const char*)&key, sizeof(key));
+        m_Out.write((const char*)&length, sizeof(length));
+        m_Out.write(op.value.data(), length);
+        m_Out.flush(); // The session can end at any moment (Ctrl+C)
+    }
+
+    // Read a binary op-log or a text script, returns false if the file can't be read
+    static bool Read(const std::string& path, std::vector<Op>& ops)
+    {
+        std::ifstream in(path, std::ios::binary);
+
+        if (!in)
+            return false;
+
+        char magic[8] = {};
+        in.read(magic, 8);
+
+        if (in.gcount() == 8 && std::memcmp(magic, OPLOG_MAGIC, 8) == 0)
+        {
+            uint8_t type;
+            int32_t key;
+            uint32_t length;
+
+            in.seekg(0, std::ios::end);
+            std::streamoff fileSize = in.tellg();
+            in.seekg(8);
+
+            while (in.read((char*)&type, sizeof(type)) && in.read((char*)&key, sizeof(key)) && in.read((char*)&length, sizeof(length)))
+            {
+                // A length past the end of the file is a damaged op-log (don't allocate it)
+                if (length > fileSize - in.tellg())
+                {
+                    std::cout << "\tDamaged op-log: value of " << length << " bytes past the end of the file" << std::endl;
+                    return false;
+                }
+
+                std::string value(length, '\0');
+
+                if (!in.read(&value[0], length))
+                    break;
+
+                ops.push_back({ type, key, std::move(value) });
+            }
+
+            return true;
+        }
+
+        // Text script
+        in.clear();
+        in.seekg(0);
+
+        std::string line;
+
+        while (std::getline(in, line))
+        {
+            std::istringstream words(line);
+            std::string command;
+            Op op = { 0, 0, "" };
+
+            if (!(words >> command) || command[0] == '#')
+                continue;
+
+            if (command == "add" && (words >> op.key >> op.value))
+                op.type = OP_ADD;
+            else if (command == "search" && (words >> op.key))
+                op.type = OP_SEARCH;
+            else if (command == "show")
+                op.type = OP_SHOW;
+            else if (command == "settings")
+            {
+                op.type = OP_SETTINGS;
+                std::getline(words, op.value);
+            }
+            else
+            {
+                std::cout << "\tInvalid line: " << line << std::endl;
+                continue;
+            }
+
+            ops.push_back(std::move(op));
+        }
+
+        return true;
+    }
+};
+
 // -------------------------------------------------------------
 // ----------------- Menu Function -----------------------------
 // -------------------------------------------------------------
 
-void Menu()
+// (recorder) saves the operations of the session when it is open
+void Menu(OpLog* recorder = nullptr)
 {
     Manager<std::string> m_Archive;
 
@@ -599,15 +981,24 @@ void Menu()
                 break;
             }
 
-            m_Archive.Add(key, value);
+            if (recorder != nullptr)
+                recorder->Append({ OP_ADD, key, value });
+
+            m_Archive.Add(key, std::move(value));
             break;
         case 2:
             std::cout << "\n\t[~] Enter the key:  ";
             std::cin >> key;
 
+            if (recorder != nullptr)
+                recorder->Append({ OP_SEARCH, key, "" });
+
             m_Archive.Search(key);
             break;
         case 3:
+            if (recorder != nullptr)
+                recorder->Append({ OP_SHOW, 0, "" });
+
             m_Archive.Show();
             break;
         case 4:
@@ -630,8 +1021,9 @@ void Init()
         std::cout << "\n\t\t[1] Set the number of records per block (N)" << std::endl;
         std::cout << "\n\t\t[2] Set the maximum number of records (RECORDS)" << std::endl;
         std::cout << "\n\t\t[3] Set the maximum number of records for the overflow area (OMAX)" << std::endl;
-        std::cout << "\n\t\t[4] Keep default settings (N = 3, RECORDS = 9, OMAX = 3)" << std::endl;
-        std::cout << "\n\t\t[5] Exit" << std::endl;
+        std::cout << "\n\t\t[4] Set the fill factor of the blocks at load time (FILL %)" << std::endl;
+        std::cout << "\n\t\t[5] Keep default settings (N = 3, RECORDS = 9, OMAX = 3, FILL = 50)" << std::endl;
+        std::cout << "\n\t\t[6] Exit" << std::endl;
         std::cout << "\n\n\t\t ~~~~~ the max values for each parameter are * " << MAX_RECORDS << "(MAX_RECORDS) * " << CAPACITY << "(RECORDS_PER_BLOCK) * " << MAX_OVERFLOW << "(OVERFLOW_AREA) * " << std::endl;
         std::cout << "\n\t\t ~~~~~ the maximum number of records might can be divided by the number of records per block (N) ~~~~~" << std::endl;
 
@@ -689,13 +1081,28 @@ void Init()
                 break;
 
             case 4:
-                std::cout << "\n\t\tKeep/set settings default (BLOCKS = 3, N = 3, OMAX = 3) :)\n" << std::endl;
+                std::cout << "\n\t\t[~] Enter the fill factor of the blocks (1 - 100):  ";
+                std::cin >> FILL;
 
-                return;
+                if (FILL <= 0 || FILL > 100)
+                {
+                    std::cout << "\n\tInvalid fill factor.\n" << std::endl;
+                    FILL = 50; // Set to default value
+                    break;
+                }
+
+                std::cout << "\n\t\t[*] the new fill factor is * " << FILL << "% * (" << FillLimit() << " records per block at load time)" << std::endl;
 
                 break;
 
             case 5:
+                std::cout << "\n\t\tKeep/set settings default (BLOCKS = 3, N = 3, OMAX = 3, FILL = 50) :)\n" << std::endl;
+
+                return;
+
+                break;
+
+            case 6:
                 std::cout << "\n\t\tExiting...\n" << std::endl;
 
                 return;
@@ -710,15 +1117,215 @@ void Init()
     }
 }
 
+// -------------------------------------------------------------
+// ----------------- Replay Function ---------------------------
+// -------------------------------------------------------------
+
+// Apply a settings line "<N> <RECORDS> <BLOCKS> <OMAX> <FILL>" with the bounds of Init,
+// returns false (and keeps the settings) if a value is missing or out of bounds
+bool ApplySettings(const std::string& line)
+{
+    std::istringstream values(line);
+    int n, records, blocks, omax, fill;
+
+    if (!(values >> n >> records >> blocks >> omax >> fill))
+    {
+        std::cout << "\tInvalid settings: " << line << std::endl;
+        return false;
+    }
+
+    if (n <= 0 || n > CAPACITY || records <= 0 || records > MAX_RECORDS || blocks <= 0 || blocks > MAX_BLOCKS
+        || omax <= 0 || fill <= 0 || fill > 100)
+    {
+        std::cout << "\tSettings out of bounds: " << line << std::endl;
+        return false;
+    }
+
+    N = n;
+    RECORDS = records;
+    BLOCKS = blocks;
+    OMAX = omax;
+    FILL = fill;
+    OVER = ((N * BLOCKS) + 1);
+
+    return true;
+}
+
+// Run the operations of a script or op-log at full speed (no prompts, no output per operation)
+// and print the throughput and the latencies of each type of operation.
+// Returns false if the settings of the script are invalid (nothing is run)
+bool Replay(const std::vector<Op>& ops)
+{
+    // The settings of the session must be applied before the file is created
+    if (!ops.empty() && ops[0].type == OP_SETTINGS && !ApplySettings(ops[0].value))
+    {
+        return false;
+    }
+
+    Manager<std::string> m_Archive;
+    m_Archive.setVerbose(false);
+
+    std::vector<long long> latencies[OP_SHOW + 1]; // Nanoseconds, by type of operation
+
+    int found = 0;
+    int added = 0;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (const Op& op : ops)
+    {
+        auto opStart = std::chrono::steady_clock::now();
+
+        switch (op.type)
+        {
+        case OP_ADD:
+            added += m_Archive.Add(op.key, op.value);
+            break;
+        case OP_SEARCH:
+            found += m_Archive.Search(op.key);
+            break;
+        case OP_SHOW:
+            m_Archive.Show();
+            break;
+        default:
+            continue;
+        }
+
+        latencies[op.type].push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - opStart).count());
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "\n\t\t ~~~ Replay ~~~ \n\n";
+    std::cout << "\t[*] Operations: " << ops.size() << " in " << seconds << " s => " << (ops.size() / std::max(seconds, 1e-9)) << " ops/s\n";
+    std::cout << "\t[*] Added: " << added << " => Found: " << found << "\n";
+
+    m_Archive.ShowMemory();
+
+    const char* names[OP_SHOW + 1] = { "", "Add", "Search", "Show" };
+
+    for (int type = OP_ADD; type <= OP_SHOW; type++)
+    {
+        std::vector<long long>& lat = latencies[type];
+
+        if (lat.empty())
+            continue;
+
+        std::sort(lat.begin(), lat.end());
+
+        std::cout << "\t[*] " << names[type] << ": " << lat.size() << " ops => p50: " << lat[lat.size() / 2]
+                  << " ns, p99: " << lat[lat.size() * 99 / 100] << " ns, max: " << lat.back() << " ns\n";
+    }
+
+    std::cout.flush();
+
+    return true;
+}
+
+// -------------------------------------------------------------
+// ----------------- Check Function ----------------------------
+// -------------------------------------------------------------
+
+// Fill a Manager for each number of records per block (N = 1 .. CAPACITY) with keys in order and then
+// with keys in between them, most of them in the first block (a hot key range, so its blocks are split),
+// and search every key that was added. Returns the number of settings with wrong results
+int CheckSplits()
+{
+    int failed = 0;
+
+    for (int n = 1; n <= CAPACITY; n++)
+    {
+        N = n;
+        BLOCKS = MAX_BLOCKS;
+        OMAX = 3;
+        OVER = ((N * BLOCKS) + 1);
+
+        Manager<std::string> m_Archive;
+        m_Archive.setVerbose(false);
+
+        std::vector<int> keys;
+
+        for (int i = 1; i <= N * BLOCKS / 2; i++)
+            keys.push_back(10 * i);
+
+        for (int i = 1; i <= N * BLOCKS; i++)
+            keys.push_back((i % 3 == 0) ? 10 * i + 5 : 10 + i % 9 + 1);
+
+        std::vector<int> added;
+
+        for (int key : keys)
+        {
+            if (m_Archive.Add(key, "value " + std::to_string(key)))
+                added.push_back(key);
+        }
+
+        int lost = 0;
+
+        for (int key : added)
+        {
+            if (!m_Archive.Search(key))
+                lost++;
+        }
+
+        // A key that was never added can't be found
+        if (m_Archive.Search(1))
+            lost++;
+
+        std::cout << "N = " << n << ":\t" << added.size() << " added\t" << ((lost == 0) ? "ok" : std::to_string(lost) + " WRONG") << std::endl;
+
+        failed += (lost != 0) ? 1 : 0;
+    }
+
+    return failed;
+}
+
 // -------------------------------------------------------------
 // ----------------- Main Function -----------------------------
 // -------------------------------------------------------------
 
-int main()
+// Usage:
+//  (no arguments)        interactive settings and menu
+//  --check               fill and search the engine with each number of records per block (N = 1 .. CAPACITY)
+//  --replay <file>       replay a text script or a binary op-log with the default settings
+//  --record <file>       interactive session, the operations are saved on a binary op-log
+
+int main(int argc, char** argv)
 {
+    if (argc > 1 && std::string(argv[1]) == "--check")
+    {
+        return (CheckSplits() == 0) ? 0 : 1;
+    }
+
+    std::string mode = (argc > 2) ? argv[1] : "";
+
+    if (mode == "--replay")
+    {
+        std::vector<Op> ops;
+
+        if (!OpLog::Read(argv[2], ops))
+        {
+            std::cout << "\n\tCan't read " << argv[2] << std::endl;
+            return 1;
+        }
+
+        return Replay(ops) ? 0 : 1;
+    }
+
+    OpLog recorder;
+
+    if (mode == "--record" && !recorder.Open(argv[2]))
+    {
+        std::cout << "\n\tCan't create " << argv[2] << std::endl;
+        return 1;
+    }
+
     Init();
 
-    Menu();
+    // Save the settings, the replay needs them to build the same file
+    recorder.Append({ OP_SETTINGS, 0, std::to_string(N) + " " + std::to_string(RECORDS) + " " + std::to_string(BLOCKS)
+                                      + " " + std::to_string(OMAX) + " " + std::to_string(FILL) });
+
+    Menu(&recorder);
 
     //[*] Test code (if you don't want to use the menu and init function) [*]
 
@@ -765,4 +1372,6 @@ int main()
     // m_Archive.Show();
 
     // std::cin.get();
+
+    return 0;
 }
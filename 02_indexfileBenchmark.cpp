@@ -0,0 +1,295 @@
+// The headers of the two programs come first, so they stay out of the namespaces below
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <thread>
+#include <functional>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <future>
+#include <optional>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <climits>
+#include <charconv>
+#include <queue>
+#include <random>
+#include <cmath>
+#include <map>
+#include <unordered_map>
+#include <fstream>
+#include <sstream>
+
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#endif
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/io_uring.h>
+
+// Same workloads on the engines of the two programs: each program is compiled here in a namespace
+// of its own (its main is renamed), so the rows measure the code the programs run
+
+namespace st
+{
+#define main StaticMain
+#include "01_indexfileStatic.cpp"
+#undef main
+}
+
+namespace dyn
+{
+#define main DynamicMain
+#include "00_indexfileDynamic.cpp"
+#undef main
+}
+
+// The settings of the dynamic engine are macros, the static engine has variables with the same names
+#undef N
+#undef BLOCKS
+#undef OMAX
+#undef OVER
+
+struct BenchConfig
+{
+    int records = 200000;
+    int blocks = 8192;
+    int capacity = 64;
+    int overflow = 4096;
+    int operations = 1000000;
+};
+
+// Keys of the records: sequential IDs with small gaps (the keys in the middle are left for the inserts)
+std::vector<int> MakeKeys(int count, std::mt19937& random)
+{
+    std::vector<int> keys;
+    int key = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        key += 2 + random() % 4;
+        keys.push_back(key);
+    }
+
+    return keys;
+}
+
+// -------------------------------------------------------------
+// ----------------- Engines -----------------------------------
+// -------------------------------------------------------------
+
+// Dynamic engine (00_indexfileDynamic.cpp) with the blocks of the configuration
+struct DynamicEngine
+{
+    dyn::Manager<std::string> manager;
+
+    static const char* Name() { return "dynamic"; }
+
+    // Settings of the engine before the Managers are built, returns the number of records it gets
+    static int Prepare(const BenchConfig& config) { return config.records; }
+
+    static bool HasScan() { return true; }
+
+    explicit DynamicEngine(const BenchConfig& config) : manager(config.blocks, config.capacity, config.overflow)
+    {
+        manager.setVerbose(false);
+    }
+
+    bool Add(int key, std::string value) { return manager.Add(key, std::move(value)); }
+
+    bool Find(int key)
+    {
+        std::string value;
+        return manager.Find(key, value);
+    }
+
+    int Scan(int from, int to)
+    {
+        int visited = 0;
+        manager.Scan(from, to, [&visited](const dyn::Record<std::string>&) { visited++; });
+
+        return visited;
+    }
+};
+
+// Static engine (01_indexfileStatic.cpp): its settings are globals bounded as its Init does (at most
+// MAX_BLOCKS blocks of CAPACITY records), so it gets the keys that fit on its blocks
+struct StaticEngine
+{
+    st::Manager<std::string> manager;
+
+    static const char* Name() { return "static"; }
+
+    static int Prepare(const BenchConfig& config)
+    {
+        st::N = std::min(config.capacity, CAPACITY);
+        st::BLOCKS = std::min(config.blocks, MAX_BLOCKS);
+        st::OMAX = std::min(config.overflow, MAX_OVERFLOW);
+        st::OVER = st::N * st::BLOCKS + 1;
+
+        return std::min(config.records, st::N * st::BLOCKS);
+    }
+
+    static bool HasScan() { return false; }
+
+    explicit StaticEngine(const BenchConfig&)
+    {
+        manager.setVerbose(false);
+    }
+
+    bool Add(int key, std::string value) { return manager.Add(key, std::move(value)); }
+
+    bool Find(int key) { return manager.Search(key); }
+
+    int Scan(int, int) { return 0; }
+};
+
+// -------------------------------------------------------------
+// ----------------- Workloads ---------------------------------
+// -------------------------------------------------------------
+
+void ShowRow(const char* workload, const char* engine, double seconds, long long operations, long long done)
+{
+    std::cout << workload << "\t" << engine << "\t" << (long long)(operations / std::max(seconds, 1e-9)) << "\t" << done << "/" << operations << std::endl;
+}
+
+template <typename Engine>
+void RunWorkloads(const BenchConfig& config)
+{
+    using Clock = std::chrono::steady_clock;
+
+    std::mt19937 random(7);
+    std::vector<int> keys = MakeKeys(Engine::Prepare(config), random);
+
+    // (1) Load in key order
+    {
+        Engine engine(config);
+        long long added = 0;
+        auto start = Clock::now();
+
+        for (int key : keys)
+            added += engine.Add(key, "value " + std::to_string(key));
+
+        ShowRow("seq-load", Engine::Name(), std::chrono::duration<double>(Clock::now() - start).count(), keys.size(), added);
+    }
+
+    // (2) Load in random order
+    {
+        Engine engine(config);
+        std::vector<int> shuffled = keys;
+        std::shuffle(shuffled.begin(), shuffled.end(), random);
+
+        long long added = 0;
+        auto start = Clock::now();
+
+        for (int key : shuffled)
+            added += engine.Add(key, "value " + std::to_string(key));
+
+        ShowRow("rand-load", Engine::Name(), std::chrono::duration<double>(Clock::now() - start).count(), keys.size(), added);
+    }
+
+    // The read workloads run on a file loaded in key order
+    Engine engine(config);
+
+    for (int key : keys)
+        engine.Add(key, "value " + std::to_string(key));
+
+    // (3) Point reads of existing keys
+    {
+        std::vector<int> queries;
+
+        for (int i = 0; i < config.operations; i++)
+            queries.push_back(keys[random() % keys.size()]);
+
+        long long found = 0;
+        auto start = Clock::now();
+
+        for (int key : queries)
+            found += engine.Find(key);
+
+        ShowRow("read", Engine::Name(), std::chrono::duration<double>(Clock::now() - start).count(), queries.size(), found);
+    }
+
+    // (4) Short scans (100 records, or all of them if there are fewer), only on the engines that have them
+    if (Engine::HasScan())
+    {
+        int length = std::min<int>(100, keys.size());
+        int scans = config.operations / 100;
+        long long full = 0; // Scans that visited all the records of their range
+        auto start = Clock::now();
+
+        for (int i = 0; i < scans; i++)
+        {
+            int first = random() % (keys.size() - length + 1);
+
+            full += (engine.Scan(keys[first], keys[first + length - 1]) == length);
+        }
+
+        ShowRow("scan", Engine::Name(), std::chrono::duration<double>(Clock::now() - start).count(), scans, full);
+    }
+
+    // (5) 90% reads, 10% inserts of new keys between the loaded ones
+    {
+        long long done = 0;
+        auto start = Clock::now();
+
+        for (int i = 0; i < config.operations; i++)
+        {
+            int key = keys[random() % keys.size()];
+
+            if (random() % 10 == 0)
+                done += engine.Add(key + 1, "value " + std::to_string(key + 1));
+            else
+                done += engine.Find(key);
+        }
+
+        ShowRow("mixed", Engine::Name(), std::chrono::duration<double>(Clock::now() - start).count(), config.operations, done);
+    }
+}
+
+// Usage: 02_indexfileBenchmark [records] [blocks] [capacity] [overflow] [operations]
+int main(int argc, char** argv)
+{
+    BenchConfig config;
+
+    if (argc > 1) config.records = std::max(1, std::atoi(argv[1]));
+    if (argc > 2) config.blocks = std::max(1, std::atoi(argv[2]));
+    if (argc > 3) config.capacity = std::max(1, std::atoi(argv[3]));
+    if (argc > 4) config.overflow = std::max(1, std::atoi(argv[4]));
+    if (argc > 5) config.operations = std::atoi(argv[5]);
+
+    std::cout << "records: " << config.records << ", blocks: " << config.blocks << " x " << config.capacity
+              << ", overflow: " << config.overflow << ", operations: " << config.operations << "\n";
+
+    std::cout << "static engine: " << StaticEngine::Prepare(config) << " records, blocks: " << st::BLOCKS << " x " << st::N
+              << ", overflow: " << st::OMAX << "\n\n";
+
+    std::cout << "workload\tengine\tops/s\tdone\n";
+
+    RunWorkloads<DynamicEngine>(config);
+    RunWorkloads<StaticEngine>(config);
+
+    return 0;
+}